@@ -59,6 +59,7 @@ typedef struct Mix_Chunk {
     uint8_t *abuf;
     uint32_t alen;
     uint8_t volume;       /* Per-sample volume, 0-128 */
+    int freq;             /* Rate of unsigned 8-bit mono samples, 0 if abuf is in the mixer format */
 } Mix_Chunk;
 
 /* The different fading types supported */
@@ -97,6 +98,11 @@ Mix_Chunk * Mix_LoadWAV_RW(SDL_RWops *src, int freesrc);
 /* Load a wave file of the mixer format from a memory buffer */
 extern Mix_Chunk * Mix_QuickLoad_WAV(uint8_t *mem);
 
+/* Play len unsigned 8-bit mono samples at freq Hz straight from mem,
+   resampling them while mixing.  mem is not copied and has to stay valid
+   until the chunk is freed, which only frees mem if allocated is set. */
+extern Mix_Chunk * Mix_QuickLoad_U8(uint8_t *mem, uint32_t len, int freq);
+
 /* Free an audio chunk previously loaded */
 extern void Mix_FreeChunk(Mix_Chunk *chunk);
 extern void Mix_FreeMusic(Mix_Music *music);
@@ -153,6 +159,9 @@ extern void Mix_ChannelFinished(void (*channel_finished)(int channel));
  *  down the mixing pipeline, through any other effect functions, then finally
  *  to be mixed with the rest of the channels and music for the final output
  *  stream.
+ * Channel effects work in place on a scratch copy of at most one mixing
+ *  block of the channel's samples, posteffects on the output stream itself.
+ *  The callback runs on the audio thread, so it must not allocate or block.
  *
  */
 typedef void (*Mix_EffectFunc_t)(int chan, void *stream, int len, void *udata);
@@ -168,14 +177,22 @@ typedef void (*Mix_EffectFunc_t)(int chan, void *stream, int len, void *udata);
 typedef void (*Mix_EffectDone_t)(int chan, void *udata);
 
 
-/* You may not need to call this explicitly, unless you need to stop all
- *  effects from processing in the middle of a chunk's playback. Note that
- *  this will also shut off some internal effect processing, since
- *  Mix_SetPanning() and others may use this API under the hood. This is
- *  called internally when a channel completes playback.
- * Posteffects are never implicitly unregistered as they are for channels,
- *  but they may be explicitly unregistered through this function by
- *  specifying MIX_CHANNEL_POST for a channel.
+/* Register a special effect function, appended to the effects of (chan),
+ *  or of the posteffects for MIX_CHANNEL_POST. (d) is called when the
+ *  effect is unregistered and may be NULL. Register effects while the
+ *  channel is not playing, the mixer does not lock its chains.
+ * returns zero if error (no such channel or out of memory), nonzero if
+ *  the effect was registered.
+ */
+extern int Mix_RegisterEffect(int chan, Mix_EffectFunc_t f, Mix_EffectDone_t d, void *arg);
+
+
+/* Removes every effect of a channel, calling their done callbacks. Call it
+ *  while the channel is not playing. Channel effects stay registered across
+ *  chunks and are only dropped implicitly when Mix_AllocateChannels() removes
+ *  the channel or the mixer is closed.
+ * Posteffects may be unregistered through this function by specifying
+ *  MIX_CHANNEL_POST for a channel.
  * returns zero if error (no such channel), nonzero if all effects removed.
  *  Error messages can be retrieved from Mix_GetError().
  */
@@ -205,19 +222,12 @@ extern int Mix_UnregisterAllEffects(int channel);
  *
  * ...which isn't so hard.
  *
- * Setting (channel) to MIX_CHANNEL_POST registers this as a posteffect, and
- *  the panning will be done to the final mixed stream before passing it on
- *  to the audio device.
- *
- * This uses the Mix_RegisterEffect() API internally, and returns without
- *  registering the effect function if the audio device is not configured
- *  for stereo output. Setting both (left) and (right) to 255 causes this
- *  effect to be unregistered, since that is the data's normal state.
+ * The mixing core applies the panning as the gains it mixes the channel
+ *  with, so no effect is registered and MIX_CHANNEL_POST is not supported.
+ *  On a mono audio device only the left gain is used. The gains are stored
+ *  atomically, so a playing channel can be panned from any thread.
  *
- * returns zero if error (no such channel or Mix_RegisterEffect() fails),
- *  nonzero if panning effect enabled. Note that an audio device in mono
- *  mode is a no-op, but this call will return successful in that case.
- *  Error messages can be retrieved from Mix_GetError().
+ * returns zero if error (no such channel), nonzero otherwise.
  */
 extern int Mix_SetPanning(int channel, uint8_t left, uint8_t right);
 
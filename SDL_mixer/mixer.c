@@ -27,6 +27,15 @@
 
 #include "SDL_mixer.h"
 #include "../surface.h"
+#include "../trace.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SSE2_RESAMPLE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define NEON_RESAMPLE
+#endif
 
 /* Magic numbers for various audio file formats */
 #define RIFF        0x46464952      /* "RIFF" */
@@ -60,8 +69,22 @@ static struct _Mix_Channel
     uint32_t fade_length;
     uint32_t ticks_fade;
     effect_info *effects;
+    uint32_t step;      /* source samples per output frame in 16.16 fixed point */
+    uint32_t frac;      /* fraction of a source sample already played */
+    uint32_t panning;   /* left and right gain, 255 for full volume */
 } *mix_channel = NULL;
 
+/* The game moves a sound while the audio callback mixes it, so both gains of
+   the panning share one word that is stored and loaded atomically */
+#define PANNING(left, right)  ((uint32_t)(left) | ((uint32_t)(right) << 8))
+#if defined(_MSC_VER)
+#define PANNING_LOAD(p)       (*(volatile uint32_t *)(p))
+#define PANNING_STORE(p, v)   (*(volatile uint32_t *)(p) = (v))
+#else
+#define PANNING_LOAD(p)       __atomic_load_n((p), __ATOMIC_RELAXED)
+#define PANNING_STORE(p, v)   __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#endif
+
 static effect_info *posteffects = NULL;
 
 static int num_channels;
@@ -123,43 +146,428 @@ static void _Mix_channel_done_playing(int channel)
       channel_done_callback(channel);
 }
 
-static void *Mix_DoEffects(int chan, void *snd, int len)
+/* Runs the effects of a channel, or the posteffects, on len bytes of
+   snd in place.  The audio callback calls this, so it never allocates. */
+static void Mix_DoEffects(int chan, void *snd, int len)
+{
+   effect_info *e = ((chan == MIX_CHANNEL_POST) ? posteffects : mix_channel[chan].effects);
+
+   for (; e != NULL; e = e->next)
+   {
+      if (e->callback != NULL)
+         e->callback(chan, snd, len, e->udata);
+   }
+}
+
+static effect_info **Mix_EffectList(int chan)
+{
+   if (chan == MIX_CHANNEL_POST)
+      return(&posteffects);
+   if (chan < 0 || chan >= num_channels)
+      return(NULL);
+   return(&mix_channel[chan].effects);
+}
+
+/* Add an effect to the end of the chain of a channel, or the posteffects */
+int Mix_RegisterEffect(int chan, Mix_EffectFunc_t f, Mix_EffectDone_t d, void *arg)
+{
+   effect_info **list = Mix_EffectList(chan);
+   effect_info *e;
+
+   if (list == NULL || f == NULL)
+      return(0);
+
+   e = (effect_info *)malloc(sizeof(effect_info));
+   if (e == NULL)
+      return(0);
+
+   e->callback = f;
+   e->done_callback = d;
+   e->udata = arg;
+   e->next = NULL;
+
+   /* link it last, once it is complete */
+   while (*list != NULL)
+      list = &(*list)->next;
+   *list = e;
+   return(1);
+}
+
+int Mix_UnregisterAllEffects(int channel)
 {
-   int posteffect = (chan == MIX_CHANNEL_POST);
-   effect_info *e = ((posteffect) ? posteffects : mix_channel[chan].effects);
-   void *buf = snd;
+   effect_info **list = Mix_EffectList(channel);
+   effect_info *e, *next;
 
-   /* are there any registered effects? */
-   if (e != NULL)
+   if (list == NULL)
+      return(0);
+
+   e = *list;
+   *list = NULL;
+   for (; e != NULL; e = next)
+   {
+      next = e->next;
+      if (e->done_callback != NULL)
+         e->done_callback(channel, e->udata);
+      free(e);
+   }
+   return(1);
+}
+
+
+/*
+ * Polyphase resampling of unsigned 8-bit chunks.  An output frame is the
+ * cubic Lagrange interpolation of the four source samples around it, with
+ * the weights looked up by the fraction of its position instead of being
+ * computed per frame.  The weights are 1.14 fixed point, so the weighted
+ * sum of the samples shifted right by 6 is the sample scaled to 16 bits.
+ */
+#define RESAMPLE_PHASES 256
+#define RESAMPLE_TAPS   4
+#define RESAMPLE_BATCH  4
+
+static int16_t resample_taps[RESAMPLE_PHASES][RESAMPLE_TAPS];
+
+static void init_resample_taps(void)
+{
+   int p, k, sum;
+   double t, w[RESAMPLE_TAPS];
+
+   for ( p=0; p<RESAMPLE_PHASES; ++p )
    {
-      /* if this is the postmix, we can just overwrite the original. */
-      if (!posteffect)
+      t = (double)p / RESAMPLE_PHASES;
+      w[0] = -t * (t - 1) * (t - 2) / 6;
+      w[1] = (t + 1) * (t - 1) * (t - 2) / 2;
+      w[2] = -(t + 1) * t * (t - 2) / 2;
+      w[3] = (t + 1) * t * (t - 1) / 6;
+
+      sum = 0;
+      for ( k=0; k<RESAMPLE_TAPS; ++k )
       {
-         buf = malloc(len);
-         if (buf == NULL)
-            return(snd);
-         memcpy(buf, snd, len);
+         resample_taps[p][k] = (int16_t)(w[k] * 16384 + (w[k] < 0 ? -0.5 : 0.5));
+         sum += resample_taps[p][k];
       }
+      /* the weights have to add up to exactly one, or silence would hum */
+      resample_taps[p][(p < RESAMPLE_PHASES / 2) ? 1 : 2] += 16384 - sum;
+   }
+}
 
-      for (; e != NULL; e = e->next)
+/* One frame from the samples around src, of which only before samples
+   before it and left samples from it on exist, the others are silence */
+static int16_t resample_frame(const uint8_t *src, int before, int left, const int16_t *taps)
+{
+   int32_t sum = 0;
+   int k;
+
+   for ( k=-1; k<RESAMPLE_TAPS-1; ++k )
+   {
+      if ( k >= -before && k < left )
+         sum += taps[k+1] * (src[k] - 128);
+   }
+   sum >>= 6;
+
+   if ( sum > 32767 )
+      return 32767;
+   if ( sum < -32768 )
+      return -32768;
+   return (int16_t)sum;
+}
+
+/* RESAMPLE_BATCH frames from positions frac, frac+step, ... after src,
+   whose samples all lie inside the chunk */
+static void resample_batch(const uint8_t *src, uint32_t frac, uint32_t step, int16_t *out)
+{
+#if defined(SSE2_RESAMPLE)
+   __m128i zero = _mm_setzero_si128();
+   __m128i bias = _mm_set1_epi16(128);
+   __m128i pair[2], sum;
+   uint32_t pos, window;
+   int j;
+
+   /* madd sums two taps of two frames at once */
+   for ( j=0; j<2; ++j )
+   {
+      __m128i samples, taps[2];
+      int w[2], f;
+
+      for ( f=0; f<2; ++f )
+      {
+         pos = frac + (uint32_t)(j*2+f) * step;
+         memcpy(&window, src + (pos >> 16) - 1, sizeof(window));
+         w[f] = (int)window;
+         taps[f] = _mm_loadl_epi64((const __m128i *)resample_taps[(pos >> 8) & 0xFF]);
+      }
+
+      samples = _mm_unpacklo_epi32(_mm_cvtsi32_si128(w[0]), _mm_cvtsi32_si128(w[1]));
+      samples = _mm_sub_epi16(_mm_unpacklo_epi8(samples, zero), bias);
+      pair[j] = _mm_madd_epi16(samples, _mm_unpacklo_epi64(taps[0], taps[1]));
+      pair[j] = _mm_shuffle_epi32(pair[j], _MM_SHUFFLE(3,1,2,0));
+   }
+
+   sum = _mm_add_epi32(_mm_unpacklo_epi64(pair[0], pair[1]), _mm_unpackhi_epi64(pair[0], pair[1]));
+   sum = _mm_srai_epi32(sum, 6);
+   _mm_storel_epi64((__m128i *)out, _mm_packs_epi32(sum, sum));
+#elif defined(NEON_RESAMPLE)
+   int16_t samples[RESAMPLE_BATCH][RESAMPLE_TAPS];
+   const int16_t *taps[RESAMPLE_BATCH];
+   int32x4_t prod[RESAMPLE_BATCH];
+   int32x2_t half[RESAMPLE_BATCH];
+   uint32_t pos;
+   int j, k;
+
+   for ( j=0; j<RESAMPLE_BATCH; ++j )
+   {
+      pos = frac + (uint32_t)j * step;
+      for ( k=0; k<RESAMPLE_TAPS; ++k )
+         samples[j][k] = src[(pos >> 16) + k - 1] - 128;
+      taps[j] = resample_taps[(pos >> 8) & 0xFF];
+
+      prod[j] = vmull_s16(vld1_s16(samples[j]), vld1_s16(taps[j]));
+      half[j] = vadd_s32(vget_low_s32(prod[j]), vget_high_s32(prod[j]));
+   }
+
+   vst1_s16(out, vqshrn_n_s32(vcombine_s32(vpadd_s32(half[0], half[1]),
+               vpadd_s32(half[2], half[3])), 6));
+#else
+   uint32_t pos;
+   int j;
+
+   for ( j=0; j<RESAMPLE_BATCH; ++j )
+   {
+      pos = frac + (uint32_t)j * step;
+      out[j] = resample_frame(src + (pos >> 16), 1, RESAMPLE_TAPS - 1,
+            resample_taps[(pos >> 8) & 0xFF]);
+   }
+#endif
+}
+
+/* Resamples up to frames frames of the unsigned 8-bit chunk playing on
+   the channel into 16-bit frames of the mixer format, any rate to any
+   rate.  Returns the frames made. */
+static int resample_u8(struct _Mix_Channel *channel, int16_t *out, int frames)
+{
+   const uint8_t *src = channel->samples;
+   int before = src > channel->chunk->abuf;
+   int left = channel->playing;
+   uint32_t frac = channel->frac;
+   uint32_t step = channel->step;
+   int16_t batch[RESAMPLE_BATCH];
+   int n = 0, count, i, c, advance;
+
+   while ( n < frames && left > 0 )
+   {
+      /* whole batches while their samples lie inside the chunk */
+      if ( before && n + RESAMPLE_BATCH <= frames &&
+            (int)((frac + (RESAMPLE_BATCH-1) * step) >> 16) + RESAMPLE_TAPS - 2 < left )
       {
-         if (e->callback != NULL)
-            e->callback(chan, buf, len, e->udata);
+         resample_batch(src, frac, step, batch);
+         count = RESAMPLE_BATCH;
       }
+      else
+      {
+         batch[0] = resample_frame(src, before, left, resample_taps[frac >> 8]);
+         count = 1;
+      }
+
+      for ( i=0; i<count; ++i )
+      {
+         for ( c=0; c<mixer.channels; ++c )
+            *out++ = batch[i];
+      }
+      n += count;
+
+      frac += (uint32_t)count * step;
+      advance = (int)(frac >> 16);
+      src  += advance;
+      left -= advance;
+      frac &= 0xFFFF;
+      if ( advance )
+         before = 1;
+   }
+
+   channel->samples = (uint8_t *)src;
+   channel->playing = (left > 0) ? left : 0;
+   channel->frac = frac;
+   return n;
+}
+
+/*
+ * The mixing core.  The output is mixed in blocks: the music in the block
+ * is widened into 32-bit sums, every playing channel adds its samples
+ * times its gain for each side, and only the final sums are clamped back
+ * to 16 bits.  The mixer always runs in 16-bit native endian format.
+ */
+#define MIX_BLOCK_SAMPLES 1024
+
+/* Gains are 1.7 fixed point, 128 passes a sample through unchanged */
+static void mix_widen(int32_t *accum, const int16_t *stream, int count)
+{
+   int i = 0;
+
+#if defined(SSE2_RESAMPLE)
+   for ( ; i+8<=count; i+=8 )
+   {
+      __m128i s = _mm_loadu_si128((const __m128i *)(stream+i));
+      _mm_storeu_si128((__m128i *)(accum+i), _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+      _mm_storeu_si128((__m128i *)(accum+i+4), _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+   }
+#elif defined(NEON_RESAMPLE)
+   for ( ; i+8<=count; i+=8 )
+   {
+      int16x8_t s = vld1q_s16(stream+i);
+      vst1q_s32(accum+i, vmovl_s16(vget_low_s16(s)));
+      vst1q_s32(accum+i+4, vmovl_s16(vget_high_s16(s)));
+   }
+#endif
+   for ( ; i<count; ++i )
+      accum[i] = stream[i];
+}
+
+/* Adds count samples times the gains, interleaved left and right on a
+   stereo mixer, to the sums */
+static void mix_accumulate(int32_t *accum, const int16_t *samples, int count, int left, int right)
+{
+   int i = 0;
+
+#if defined(SSE2_RESAMPLE)
+   __m128i gain = _mm_set_epi16(right, left, right, left, right, left, right, left);
+
+   for ( ; i+8<=count; i+=8 )
+   {
+      __m128i s  = _mm_loadu_si128((const __m128i *)(samples+i));
+      __m128i lo = _mm_mullo_epi16(s, gain);
+      __m128i hi = _mm_mulhi_epi16(s, gain);
+      __m128i a0 = _mm_loadu_si128((const __m128i *)(accum+i));
+      __m128i a1 = _mm_loadu_si128((const __m128i *)(accum+i+4));
+      a0 = _mm_add_epi32(a0, _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 7));
+      a1 = _mm_add_epi32(a1, _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 7));
+      _mm_storeu_si128((__m128i *)(accum+i), a0);
+      _mm_storeu_si128((__m128i *)(accum+i+4), a1);
+   }
+#elif defined(NEON_RESAMPLE)
+   const int16_t gains[8] = { left, right, left, right, left, right, left, right };
+   int16x8_t gain = vld1q_s16(gains);
+
+   for ( ; i+8<=count; i+=8 )
+   {
+      int16x8_t s = vld1q_s16(samples+i);
+      vst1q_s32(accum+i, vaddq_s32(vld1q_s32(accum+i),
+               vshrq_n_s32(vmull_s16(vget_low_s16(s), vget_low_s16(gain)), 7)));
+      vst1q_s32(accum+i+4, vaddq_s32(vld1q_s32(accum+i+4),
+               vshrq_n_s32(vmull_s16(vget_high_s16(s), vget_high_s16(gain)), 7)));
+   }
+#endif
+   /* i stays even, so the sides stay in step */
+   for ( ; i<count; ++i )
+      accum[i] += (samples[i] * ((i & 1) ? right : left)) >> 7;
+}
+
+static void mix_clamp(int16_t *stream, const int32_t *accum, int count)
+{
+   int i = 0;
+
+#if defined(SSE2_RESAMPLE)
+   for ( ; i+8<=count; i+=8 )
+   {
+      __m128i a0 = _mm_loadu_si128((const __m128i *)(accum+i));
+      __m128i a1 = _mm_loadu_si128((const __m128i *)(accum+i+4));
+      _mm_storeu_si128((__m128i *)(stream+i), _mm_packs_epi32(a0, a1));
    }
+#elif defined(NEON_RESAMPLE)
+   for ( ; i+8<=count; i+=8 )
+      vst1q_s16(stream+i, vcombine_s16(vqmovn_s32(vld1q_s32(accum+i)), vqmovn_s32(vld1q_s32(accum+i+4))));
+#endif
+   for ( ; i<count; ++i )
+   {
+      if ( accum[i] > 32767 )
+         stream[i] = 32767;
+      else if ( accum[i] < -32768 )
+         stream[i] = -32768;
+      else
+         stream[i] = (int16_t)accum[i];
+   }
+}
+
+/* Adds len bytes of a channel to the sums of a block, resampling unsigned
+   8-bit chunks on the way */
+static void mix_channel_block(int which, int32_t *accum, int len)
+{
+   struct _Mix_Channel *channel = &mix_channel[which];
+   int16_t frames[MIX_BLOCK_SAMPLES];
+   int framesize = (int)sizeof(int16_t) * mixer.channels;
+   int volume = (channel->volume*channel->chunk->volume) / MIX_MAX_VOLUME;
+   uint32_t panning = PANNING_LOAD(&channel->panning);
+   int left = volume * (int)(panning & 0xff) / 255;
+   int right = (mixer.channels == 2) ? volume * (int)(panning >> 8) / 255 : left;
+   int index = 0;
+   int mixable;
+   uint8_t *input;
+
+   while ( channel->playing > 0 && index < len )
+   {
+      if ( channel->chunk->freq )
+      {
+         input = (uint8_t *)frames;
+         mixable = resample_u8(channel, frames, (len - index) / framesize) * framesize;
+         if ( mixable == 0 )
+            break;
+      }
+      else
+      {
+         input = channel->samples;
+         mixable = channel->playing;
+         if ( mixable > len - index )
+            mixable = len - index;
+         channel->samples += mixable;
+         channel->playing -= mixable;
+      }
 
-   /* be sure to free() the return value if != snd ... */
-   return(buf);
+      /* effects change the samples, so they get a copy of the chunk */
+      if ( channel->effects != NULL )
+      {
+         if ( input != (uint8_t *)frames )
+         {
+            memcpy(frames, input, mixable);
+            input = (uint8_t *)frames;
+         }
+         Mix_DoEffects(which, input, mixable);
+      }
+
+      mix_accumulate(accum + index / 2, (const int16_t *)input, mixable / 2, left, right);
+      index += mixable;
+
+      /* rcg06072001 Alert app if channel is done playing. */
+      if ( ! channel->playing )
+      {
+         if ( channel->looping )
+         {
+            if (channel->looping > 0)
+               --channel->looping;
+            channel->samples = channel->chunk->abuf;
+            channel->playing = channel->chunk->alen;
+            channel->frac = 0;
+         }
+         else
+            _Mix_channel_done_playing(which);
+      }
+   }
 }
 
+static int mix_channel_active(int which)
+{
+   return !mix_channel[which].paused && mix_channel[which].playing > 0;
+}
 
 /* Mixing function */
 static void mix_channels(void *udata, uint8_t *stream, int len)
 {
-   uint8_t *mix_input;
-   int i, mixable, volume = SDL_MIX_MAXVOLUME;
+   int32_t accum[MIX_BLOCK_SAMPLES];
+   int i, index, block, active;
    uint32_t sdl_ticks;
 
+   if (lr_tracing)
+      LR_TraceThreadName("audio");
+   LR_TRACE_BEGIN("mix_channels");
+
    /* Need to initialize the stream in SDL 1.3+ */
    memset(stream, mixer.silence, len);
 
@@ -167,7 +575,7 @@ static void mix_channels(void *udata, uint8_t *stream, int len)
    if ( music_active || (mix_music != music_mixer) )
       mix_music(music_data, stream, len);
 
-   /* Mix any playing channels... */
+   /* Expire and fade the channels... */
    sdl_ticks = LR_GetTicks();
    for ( i=0; i<num_channels; ++i )
    {
@@ -208,66 +616,33 @@ static void mix_channels(void *udata, uint8_t *stream, int len)
                   Mix_Volume(i, (mix_channel[i].fade_volume * ticks) / mix_channel[i].fade_length );
             }
          }
+      }
+   }
 
-         if ( mix_channel[i].playing > 0 )
-         {
-            int index = 0;
-            int remaining = len;
-            while (mix_channel[i].playing > 0 && index < len)
-            {
-               remaining = len - index;
-               volume = (mix_channel[i].volume*mix_channel[i].chunk->volume) / MIX_MAX_VOLUME;
-               mixable = mix_channel[i].playing;
-               if ( mixable > remaining )
-                  mixable = remaining;
-
-               mix_input = Mix_DoEffects(i, mix_channel[i].samples, mixable);
-               SDL_MixAudio(stream+index,mix_input,mixable,volume);
-               if (mix_input != mix_channel[i].samples)
-                  free(mix_input);
-
-               mix_channel[i].samples += mixable;
-               mix_channel[i].playing -= mixable;
-               index += mixable;
-
-               /* rcg06072001 Alert app if channel is done playing. */
-               if (!mix_channel[i].playing && !mix_channel[i].looping)
-                  _Mix_channel_done_playing(i);
-            }
+   /* ...and mix the playing ones */
+   active = 0;
+   for ( i=0; i<num_channels; ++i )
+      active |= mix_channel_active(i);
 
-            /* If looping the sample and we are at its end, make sure
-               we will still return a full buffer */
-            while ( mix_channel[i].looping && index < len )
-            {
-               int alen = mix_channel[i].chunk->alen;
-               remaining = len - index;
-               if (remaining > alen)
-                  remaining = alen;
-
-               mix_input = Mix_DoEffects(i, mix_channel[i].chunk->abuf, remaining);
-               SDL_MixAudio(stream+index, mix_input, remaining, volume);
-               if (mix_input != mix_channel[i].chunk->abuf)
-                  free(mix_input);
-
-               if (mix_channel[i].looping > 0)
-                  --mix_channel[i].looping;
-               mix_channel[i].samples = mix_channel[i].chunk->abuf + remaining;
-               mix_channel[i].playing = mix_channel[i].chunk->alen - remaining;
-               index += remaining;
-            }
-            if ( ! mix_channel[i].playing && mix_channel[i].looping )
-            {
-               if (mix_channel[i].looping > 0)
-                  --mix_channel[i].looping;
-               mix_channel[i].samples = mix_channel[i].chunk->abuf;
-               mix_channel[i].playing = mix_channel[i].chunk->alen;
-            }
-         }
+   for ( index=0; active && index<len; index+=block )
+   {
+      block = len - index;
+      if ( block > MIX_BLOCK_SAMPLES * 2 )
+         block = MIX_BLOCK_SAMPLES * 2;
+
+      mix_widen(accum, (const int16_t *)(stream+index), block / 2);
+      for ( i=0; i<num_channels; ++i )
+      {
+         if ( mix_channel_active(i) )
+            mix_channel_block(i, accum, block);
       }
+      mix_clamp((int16_t *)(stream+index), accum, block / 2);
    }
 
    /* rcg06122001 run posteffects... */
    Mix_DoEffects(MIX_CHANNEL_POST, stream, len);
+
+   LR_TRACE_END("mix_channels");
 }
 
 /* Open the mixer with a certain desired audio format */
@@ -288,6 +663,8 @@ int Mix_OpenAudio(int frequency, uint16_t format, int nchannels, int chunksize)
          Mix_CloseAudio();
    }
 
+   init_resample_taps();
+
    /* Set the desired format and frequency */
    desired.freq = frequency;
    desired.format = format;
@@ -300,6 +677,13 @@ int Mix_OpenAudio(int frequency, uint16_t format, int nchannels, int chunksize)
    if ( SDL_OpenAudio(&desired, &mixer) < 0 )
       return(-1);
 
+   /* ...as long as the mixing core can sum it */
+   if ( (mixer.format & 0xFF) != 16 )
+   {
+      SDL_CloseAudio();
+      return(-1);
+   }
+
    /* Initialize the music players */
    if ( open_music(&mixer) < 0 )
    {
@@ -324,6 +708,7 @@ int Mix_OpenAudio(int frequency, uint16_t format, int nchannels, int chunksize)
       mix_channel[i].expire = 0;
       mix_channel[i].effects = NULL;
       mix_channel[i].paused = 0;
+      mix_channel[i].panning = PANNING(255, 255);
    }
    Mix_VolumeMusic(SDL_MIX_MAXVOLUME);
 
@@ -351,6 +736,7 @@ int Mix_AllocateChannels(int numchans)
       for(i=numchans; i < num_channels; i++)
       {
          Mix_HaltChannel(i);
+         Mix_UnregisterAllEffects(i);
       }
    }
    mix_channel = (struct _Mix_Channel *) realloc(mix_channel, numchans * sizeof(struct _Mix_Channel));
@@ -371,6 +757,7 @@ int Mix_AllocateChannels(int numchans)
          mix_channel[i].expire = 0;
          mix_channel[i].effects = NULL;
          mix_channel[i].paused = 0;
+         mix_channel[i].panning = PANNING(255, 255);
       }
    }
    num_channels = numchans;
@@ -495,6 +882,7 @@ Mix_Chunk *Mix_LoadWAV_RW(SDL_RWops *src, int freesrc)
 
    chunk->allocated = 1;
    chunk->volume = MIX_MAX_VOLUME;
+   chunk->freq = 0;
 
    return(chunk);
 }
@@ -530,6 +918,29 @@ Mix_Chunk *Mix_QuickLoad_WAV(uint8_t *mem)
    return(chunk);
 }
 
+/* Load unsigned 8-bit mono samples that are resampled while mixing */
+Mix_Chunk *Mix_QuickLoad_U8(uint8_t *mem, uint32_t len, int freq)
+{
+   Mix_Chunk *chunk;
+
+   /* Make sure audio has been opened */
+   if ( ! audio_opened || freq <= 0 )
+      return(NULL);
+
+   /* Allocate the chunk memory */
+   chunk = (Mix_Chunk *)calloc(1,sizeof(Mix_Chunk));
+   if ( chunk == NULL )
+      return(NULL);
+
+   chunk->allocated = 0;
+   chunk->abuf = mem;
+   chunk->alen = len;
+   chunk->volume = MIX_MAX_VOLUME;
+   chunk->freq = freq;
+
+   return(chunk);
+}
+
 /* Free an audio chunk previously loaded */
 void Mix_FreeChunk(Mix_Chunk *chunk)
 {
@@ -601,6 +1012,10 @@ static int checkchunkintegral(Mix_Chunk *chunk)
 {
    int frame_width = 1;
 
+   /* every 8-bit mono sample is a frame of its own */
+   if (chunk->freq)
+      return chunk->alen;
+
    if ((mixer.format & 0xFF) == 16)
       frame_width = 2;
    frame_width *= mixer.channels;
@@ -654,6 +1069,9 @@ int Mix_PlayChannelTimed(int which, Mix_Chunk *chunk, int loops, int ticks)
       mix_channel[which].fading = MIX_NO_FADING;
       mix_channel[which].start_time = sdl_ticks;
       mix_channel[which].expire = (ticks > 0) ? (sdl_ticks + ticks) : 0;
+      mix_channel[which].step = chunk->freq ?
+         (uint32_t)((((uint64_t)chunk->freq << 16) + mixer.freq / 2) / mixer.freq) : 0;
+      mix_channel[which].frac = 0;
    }
 
    /* Return the channel on which the sound is being played */
@@ -704,6 +1122,18 @@ int Mix_Volume(int which, int volume)
    return(prev_volume);
 }
 
+/* Set the gains of the sides of a stereo mixer for a channel, the mixing
+   core applies them to the next block, so no effect is registered and
+   moving a playing sound costs one store */
+int Mix_SetPanning(int channel, uint8_t left, uint8_t right)
+{
+   if ( channel < 0 || channel >= num_channels )
+      return(0);
+
+   PANNING_STORE(&mix_channel[channel].panning, PANNING(left, right));
+   return(1);
+}
+
 /* Halt playing of a particular channel */
 int Mix_HaltChannel(int which)
 {
@@ -788,6 +1218,9 @@ void Mix_CloseAudio(void)
          close_music();
          Mix_HaltChannel(-1);
          SDL_CloseAudio();
+         for ( i=0; i<num_channels; ++i )
+            Mix_UnregisterAllEffects(i);
+         Mix_UnregisterAllEffects(MIX_CHANNEL_POST);
          free(mix_channel);
          mix_channel = NULL;
 
@@ -88,6 +88,7 @@ inline void logerror(...) {}
 #endif
 
 #include "fmopl.h"
+#include "trace.h"
 
 #ifndef PI
 #define PI 3.14159265358979323846
@@ -1831,6 +1832,8 @@ void YM3812UpdateOne(int which, INT16 *buffer, int length)
     OPLSAMPLE   *buf = buffer;
     int i;
 
+    LR_TRACE_BEGIN("YM3812UpdateOne");
+
     if( (void *)OPL != cur_chip ){
         cur_chip = (void *)OPL;
         /* rhythm slots */
@@ -1880,5 +1883,6 @@ void YM3812UpdateOne(int which, INT16 *buffer, int length)
         advance(OPL);
     }
 
+    LR_TRACE_END("YM3812UpdateOne");
 }
 #endif /* BUILD_YM3812 */
@@ -15,6 +15,7 @@ loaded into the data segment
 */
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #if defined _WIN32
     #include <io.h>
 #else
@@ -23,6 +24,10 @@ loaded into the data segment
 #endif
 #include "wl_def.h"
 #include <retro_endian.h>
+#ifdef HAVE_THREADS
+#include <rthreads/rthreads.h>
+#include "tasks.h"
+#endif
 
 #define THREEBYTEGRSTARTS
 
@@ -46,6 +51,16 @@ typedef struct
     int32_t headeroffsets[100];
 } mapfiletype;
 
+#define MAPCACHEVERSION 0x4d430001      /* "MC" 1, also tells the byte order */
+
+typedef struct
+{
+    uint32_t version;
+    uint32_t nummaps, numplanes, maparea_;
+    int64_t  filesize, filemtime;       /* of the gamemaps file */
+    word     rlewtag;
+} mapcacheheader;
+
 
 /*
 =============================================================================
@@ -84,6 +99,7 @@ static const char gheadname[] = "vgahead.";
 static const char gfilename[] = "vgagraph.";
 static const char gdictname[] = "vgadict.";
 static const char mheadname[] = "maphead.";
+static const char mcachename[] = "mapcache.";
 
 static const char aheadname[] = "audiohed.";
 static const char afilename[] = "audiot.";
@@ -91,6 +107,7 @@ static const char afilename[] = "audiot.";
 void CA_CannotOpen(const char *string);
 
 static int32_t  grstarts[NUMCHUNKS + 1];
+static int32_t  grsizes[NUMCHUNKS];    /* expanded sizes of the chunks loaded so far */
 static int32_t* audiostarts; /* array of offsets in audio / audiot */
 
 #ifdef GRHEADERLINKED
@@ -99,12 +116,30 @@ huffnode *grhuffman;
 huffnode grhuffman[255];
 #endif
 
-int    grhandle = -1;               /* handle to EGAGRAPH */
-int    maphandle = -1;              /* handle to MAPTEMP / GAMEMAPS */
-int    audiohandle = -1;            /* handle to AUDIOT / AUDIO */
+vfile  *grhandle;                   /* handle to EGAGRAPH */
+vfile  *maphandle;                  /* handle to MAPTEMP / GAMEMAPS */
+vfile  *audiohandle;                /* handle to AUDIOT / AUDIO */
 
 int32_t   chunkcomplen,chunkexplen;
 
+/*
+ * Fully expanded planes of every map, MAPPLANES*maparea words each.  A
+ * thread fills them after CA_Startup, CA_CacheMap fills the ones it gets
+ * to first, and with --mapcache disk they are kept in mapcache.ext until
+ * the size or modification time of the gamemaps file changes.  Entries
+ * are never changed once stored, only the pointers need the lock.
+ */
+static char      mapfname[13];
+static word     *mapcache[NUMMAPS];
+static boolean   mapcachedirty;
+static boolean   mapcachefile;      /* --mapcache disk and gamemaps is not mounted */
+static int64_t   mapfilesize, mapfilemtime;
+#ifdef HAVE_THREADS
+static sthread_t *mapcachethread;
+static slock_t   *mapcachelock;
+static volatile boolean mapcachequit;
+#endif
+
 SDMode oldsoundmode;
 
 
@@ -114,6 +149,15 @@ static int32_t GRFILEPOS(const size_t idx)
     return grstarts[idx];
 }
 
+/* a copy of a pack entry, for the callers that free what they cache */
+static byte *CAL_CopyFromPack(packentry entry)
+{
+    byte *data = (byte *) malloc(entry.size);
+    CHECKMALLOCRESULT(data);
+    memcpy(data, PK_Data(entry), entry.size);
+    return data;
+}
+
 /*
 =============================================================================
 
@@ -135,8 +179,8 @@ static int32_t GRFILEPOS(const size_t idx)
 
 void CAL_GetGrChunkLength (int chunk)
 {
-    lseek(grhandle,GRFILEPOS(chunk),SEEK_SET);
-    read(grhandle,&chunkexplen,sizeof(chunkexplen));
+    VF_Seek(grhandle,GRFILEPOS(chunk));
+    VF_Read(grhandle,&chunkexplen,sizeof(chunkexplen));
     chunkexplen = Retro_SwapLES32(chunkexplen);
     chunkcomplen = GRFILEPOS(chunk+1)-GRFILEPOS(chunk)-4;
 }
@@ -183,20 +227,19 @@ boolean CA_LoadFile (const char *filename, memptr *ptr)
 {
     int32_t size;
 
-    const int handle = open(filename, O_RDONLY | O_BINARY);
-    if (handle == -1)
+    vfile *file = VF_Open(filename);
+    if (!file)
         return false;
 
-    size = lseek(handle, 0, SEEK_END);
-    lseek(handle, 0, SEEK_SET);
+    size = VF_Size(file);
     *ptr=malloc(size);
     CHECKMALLOCRESULT(*ptr);
-    if (!read (handle,*ptr,size))
+    if (!VF_Read (file,*ptr,size))
     {
-        close (handle);
+        VF_Close (file);
         return false;
     }
-    close (handle);
+    VF_Close (file);
     return true;
 }
 
@@ -208,7 +251,11 @@ boolean CA_LoadFile (const char *filename, memptr *ptr)
 ============================================================================
 */
 
-static void CAL_HuffExpand(byte *source, byte *dest, int32_t length, huffnode *hufftable)
+/*
+ * The original decoder, one tree node per bit.  It is only kept as the
+ * reference for CA_HuffBenchmark.
+ */
+static void CAL_HuffExpandTree(byte *source, byte *dest, int32_t length, huffnode *hufftable)
 {
     byte *end;
     huffnode *headptr, *huffptr;
@@ -256,6 +303,121 @@ static void CAL_HuffExpand(byte *source, byte *dest, int32_t length, huffnode *h
     }
 }
 
+/*
+======================
+=
+= CAL_BuildHuffTable
+=
+= Walks the tree for every combination of the next HUFFTABLEBITS source
+= bits (read from the lowest bit up, like the tree walk does), so
+= CAL_HuffExpand can decode a whole code of up to that length at once.
+= An entry holds the byte and code length, or for longer codes the node
+= reached after HUFFTABLEBITS bits, to continue from bit by bit.
+=
+======================
+*/
+
+#define HUFFTABLEBITS   12
+#define HUFFTABLESIZE   (1 << HUFFTABLEBITS)
+
+typedef struct
+{
+    word value;     /* 0-255 is a character, > is a pointer to a node */
+    byte bits;      /* source bits used up */
+} hufftableentry;
+
+static hufftableentry grhufftable[HUFFTABLESIZE];
+
+static void CAL_BuildHuffTable(huffnode *hufftable, hufftableentry *table)
+{
+    int  index, bit;
+    word nodeval;
+
+    for(index = 0; index < HUFFTABLESIZE; index++)
+    {
+        nodeval = 254 + 256;        /* head node is always node 254 */
+
+        for(bit = 0; bit < HUFFTABLEBITS && nodeval >= 256; bit++)
+        {
+            huffnode *huffptr = hufftable + (nodeval - 256);
+            nodeval = (index >> bit) & 1 ? huffptr->bit1 : huffptr->bit0;
+        }
+
+        table[index].value = nodeval;
+        table[index].bits  = bit;
+    }
+}
+
+/*
+======================
+=
+= CAL_HuffExpand
+=
+= Decodes length bytes from the sourcelength bytes at source, like
+= CAL_HuffExpandTree but with one grhufftable lookup per code where the
+= code fits into it.  Bits past the end of the source read as zero.
+=
+======================
+*/
+
+static void CAL_HuffExpand(const byte *source, int32_t sourcelength, byte *dest, int32_t length,
+        huffnode *hufftable, hufftableentry *table)
+{
+    byte       *end       = dest + length;
+    const byte *sourceend = source + sourcelength;
+    uint64_t  bitbuf    = 0;
+    int       bitcount  = 0;
+
+    if(!length || !dest)
+    {
+        Quit("length or dest is null!");
+        return;
+    }
+
+    while(dest < end)
+    {
+        hufftableentry entry;
+
+        while(bitcount <= 56 && source < sourceend)
+        {
+            bitbuf   |= (uint64_t) *source++ << bitcount;
+            bitcount += 8;
+        }
+
+        entry      = table[bitbuf & (HUFFTABLESIZE - 1)];
+        bitbuf   >>= entry.bits;
+        bitcount  -= entry.bits;
+        if(bitcount < 0)
+            bitcount = 0;
+
+        if(entry.value >= 256)
+        {
+            /* a long code, follow the tree for the rest of it */
+            word nodeval = entry.value;
+
+            do
+            {
+                huffnode *huffptr = hufftable + (nodeval - 256);
+
+                if(!bitcount && source < sourceend)
+                {
+                    bitbuf   = *source++;
+                    bitcount = 8;
+                }
+
+                nodeval = bitbuf & 1 ? huffptr->bit1 : huffptr->bit0;
+                bitbuf >>= 1;
+                if(bitcount)
+                    bitcount--;
+            } while(nodeval >= 256);
+
+            entry.value = nodeval;
+        }
+
+        *dest++ = (byte) entry.value;
+    }
+}
+
 /*
 ======================
 =
@@ -439,12 +601,21 @@ void CA_RLEWexpand (word *source, word *dest, int32_t length, word rlewtag)
 void CAL_SetupGrFile (void)
 {
    char fname[13];
-   int handle;
+   vfile *handle;
    int j;
    byte *compseg;
    const byte* d = NULL;
    int32_t* i    = NULL;
 
+   if (pack)
+   {
+      /* everything else is read from the pack when it is needed */
+      pictable=(pictabletype *) malloc(NUMPICS*sizeof(pictabletype));
+      CHECKMALLOCRESULT(pictable);
+      memcpy(pictable, PK_Data(pack->pictable), NUMPICS*sizeof(pictabletype));
+      return;
+   }
+
 #ifdef GRHEADERLINKED
 
    grhuffman = (huffnode *)&EGAdict;
@@ -456,11 +627,11 @@ void CAL_SetupGrFile (void)
    strcpy(fname,gdictname);
    strcat(fname,graphext);
 
-   handle = open(fname, O_RDONLY | O_BINARY);
-   if (handle == -1)
+   handle = VF_Open(fname);
+   if (!handle)
       CA_CannotOpen(fname);
 
-   read(handle, grhuffman, sizeof(grhuffman));
+   VF_Read(handle, grhuffman, sizeof(grhuffman));
 
    for(j = 0; j < sizeof(grhuffman) / sizeof(huffnode); j++)
    {
@@ -468,18 +639,17 @@ void CAL_SetupGrFile (void)
       grhuffman[j].bit1 = (word)Retro_SwapLES16(grhuffman[j].bit1);
    }
 
-   close(handle);
+   VF_Close(handle);
 
    /* load the data offsets from ???head.ext */
    strcpy(fname,gheadname);
    strcat(fname,graphext);
 
-   handle = open(fname, O_RDONLY | O_BINARY);
-   if (handle == -1)
+   handle = VF_Open(fname);
+   if (!handle)
       CA_CannotOpen(fname);
 
-   long headersize = lseek(handle, 0, SEEK_END);
-   lseek(handle, 0, SEEK_SET);
+   long headersize = VF_Size(handle);
 
 #ifndef APOGEE_1_0
    int expectedsize = lengthof(grstarts) - numEpisodesMissing;
@@ -495,8 +665,8 @@ void CAL_SetupGrFile (void)
             fname, headersize / 3, expectedsize);
 
    byte data[lengthof(grstarts) * 3];
-   read(handle, data, sizeof(data));
-   close(handle);
+   VF_Read(handle, data, sizeof(data));
+   VF_Close(handle);
 
    d = data;
    for (i = grstarts; i != endof(grstarts); ++i)
@@ -507,12 +677,14 @@ void CAL_SetupGrFile (void)
    }
 #endif
 
+   CAL_BuildHuffTable(grhuffman, grhufftable);
+
    /* Open the graphics file, leaving it open until the game is finished */
    strcpy(fname,gfilename);
    strcat(fname,graphext);
 
-   grhandle = open(fname, O_RDONLY | O_BINARY);
-   if (grhandle == -1)
+   grhandle = VF_Open(fname);
+   if (!grhandle)
       CA_CannotOpen(fname);
 
    /* load the pic and sprite headers into the arrays in the data segment */
@@ -521,8 +693,8 @@ void CAL_SetupGrFile (void)
    CAL_GetGrChunkLength(STRUCTPIC);                /* position file pointer */
    compseg=(byte *) malloc(chunkcomplen);
    CHECKMALLOCRESULT(compseg);
-   read (grhandle,compseg,chunkcomplen);
-   CAL_HuffExpand(compseg, (byte*)pictable, NUMPICS * sizeof(pictabletype), grhuffman);
+   CAL_HuffExpand((const byte *) VF_Span(grhandle, GRFILEPOS(STRUCTPIC) + 4, chunkcomplen, compseg),
+         chunkcomplen, (byte*)pictable, NUMPICS * sizeof(pictabletype), grhuffman, grhufftable);
    free(compseg);
 
 	for (j = 0; j < NUMPICS; j++)
@@ -546,29 +718,40 @@ void CAL_SetupGrFile (void)
 void CAL_SetupMapFile (void)
 {
    int     i, j;
-   int handle;
+   vfile  *handle;
    int32_t length,pos;
    char fname[13];
 
+   /* allocate space for 3 64*64 plane */
+   for (i=0;i<MAPPLANES;i++)
+   {
+      mapsegs[i]=(word *) malloc(maparea*2);
+      CHECKMALLOCRESULT(mapsegs[i]);
+   }
+
+   /* the pack has the maps expanded already */
+   if (pack)
+      return;
+
    /* load maphead.ext (offsets and tileinfo for map file) */
    strcpy(fname,mheadname);
    strcat(fname,extension);
 
-   handle = open(fname, O_RDONLY | O_BINARY);
-   if (handle == -1)
+   handle = VF_Open(fname);
+   if (!handle)
       CA_CannotOpen(fname);
 
    length = NUMMAPS*4+2; /* used to be "filelength(handle);" */
    mapfiletype *tinf=(mapfiletype *) malloc(sizeof(mapfiletype));
    CHECKMALLOCRESULT(tinf);
-   read(handle, tinf, length);
+   VF_Read(handle, tinf, length);
 
    tinf->RLEWtag = (word)Retro_SwapLES16(tinf->RLEWtag);
 
    for(j = 0; j < sizeof(tinf->headeroffsets) / sizeof(int32_t); j++)
       tinf->headeroffsets[j] = Retro_SwapLES32(tinf->headeroffsets[j]);
 
-   close(handle);
+   VF_Close(handle);
 
    RLEWtag=tinf->RLEWtag;
 
@@ -577,17 +760,18 @@ void CAL_SetupMapFile (void)
    strcpy(fname, "gamemaps.");
    strcat(fname, extension);
 
-   maphandle = open(fname, O_RDONLY | O_BINARY);
-   if (maphandle == -1)
+   maphandle = VF_Open(fname);
+   if (!maphandle)
       CA_CannotOpen(fname);
 #else
    strcpy(fname,mfilename);
    strcat(fname,extension);
 
-   maphandle = open(fname, O_RDONLY | O_BINARY);
-   if (maphandle == -1)
+   maphandle = VF_Open(fname);
+   if (!maphandle)
       CA_CannotOpen(fname);
 #endif
+   strcpy(mapfname, fname);
 
    /* load all map header */
    for (i=0;i<NUMMAPS;i++)
@@ -598,8 +782,8 @@ void CAL_SetupMapFile (void)
 
       mapheaderseg[i]=(maptype *) malloc(sizeof(maptype));
       CHECKMALLOCRESULT(mapheaderseg[i]);
-      lseek(maphandle,pos,SEEK_SET);
-      read (maphandle,(memptr)mapheaderseg[i],sizeof(maptype));
+      VF_Seek(maphandle,pos);
+      VF_Read(maphandle,(memptr)mapheaderseg[i],sizeof(maptype));
 
       mapheaderseg[i]->height = (word)Retro_SwapLES16(mapheaderseg[i]->height);
 
@@ -613,13 +797,382 @@ void CAL_SetupMapFile (void)
    }
 
    free(tinf);
+}
 
-   /* allocate space for 3 64*64 plane */
-   for (i=0;i<MAPPLANES;i++)
+//==========================================================================
+
+/*
+======================
+=
+= CAL_ExpandMapPlanes
+=
+= Reads the planes of mapnum from handle and expands them into dest.
+= buffer holds BUFFERSIZE bytes for the compressed planes that fit,
+= planes of a mounted file are expanded from where they are.
+=
+= WOLF: This is specialized for a 64*64 map size
+=
+======================
+*/
+
+static void CAL_ExpandMapPlanes (vfile *handle, int mapnum, word **dest, int32_t *buffer)
+{
+   int32_t   pos,compressed;
+   int       plane;
+   memptr    bigbufferseg;
+   unsigned  size;
+   const byte *source;
+#ifdef CARMACIZED
+   word     *buffer2seg;
+   int32_t   expanded;
+#endif
+
+   size = maparea*2;
+
+   for (plane = 0; plane<MAPPLANES; plane++)
    {
-      mapsegs[i]=(word *) malloc(maparea*2);
-      CHECKMALLOCRESULT(mapsegs[i]);
+      pos = mapheaderseg[mapnum]->planestart[plane];
+      compressed = mapheaderseg[mapnum]->planelength[plane];
+
+      bigbufferseg = NULL;
+      if (compressed>BUFFERSIZE && !VF_InMemory(handle,pos,compressed))
+      {
+         bigbufferseg=malloc(compressed);
+         CHECKMALLOCRESULT(bigbufferseg);
+      }
+
+      source = (const byte *) VF_Span(handle,pos,compressed,bigbufferseg ? bigbufferseg : buffer);
+#ifdef CARMACIZED
+      // unhuffman, then unRLEW
+      // The huffman'd chunk has a two byte expanded length first
+      // The resulting RLEW chunk also does, even though it's not really
+      // needed
+      expanded = source[0] | source[1] << 8;
+      source += 2;
+      buffer2seg = (word *) malloc(expanded);
+      CHECKMALLOCRESULT(buffer2seg);
+      CAL_CarmackExpand((byte *) source, buffer2seg,expanded);
+      CA_RLEWexpand(buffer2seg+1,dest[plane],size,RLEWtag);
+      free(buffer2seg);
+
+#else
+      /* unRLEW, skipping expanded length */
+      CA_RLEWexpand ((word *) source+1,dest[plane],size,RLEWtag);
+#endif
+
+      free(bigbufferseg);
+   }
+}
+
+static word *CAL_CachedMapPlanes (int mapnum)
+{
+   word *planes;
+
+#ifdef HAVE_THREADS
+   if (mapcachelock)
+      slock_lock(mapcachelock);
+#endif
+   planes = mapcache[mapnum];
+#ifdef HAVE_THREADS
+   if (mapcachelock)
+      slock_unlock(mapcachelock);
+#endif
+
+   return planes;
+}
+
+/*
+======================
+=
+= CAL_StoreMapPlanes
+=
+= Puts the expanded planes of mapnum into the map cache, which takes
+= them over.  If the map is in it already, they are freed instead.
+=
+======================
+*/
+
+static void CAL_StoreMapPlanes (int mapnum, word *planes)
+{
+#ifdef HAVE_THREADS
+   if (mapcachelock)
+      slock_lock(mapcachelock);
+#endif
+
+   if (mapcache[mapnum])
+      free(planes);
+   else
+   {
+      mapcache[mapnum] = planes;
+      mapcachedirty = true;
    }
+
+#ifdef HAVE_THREADS
+   if (mapcachelock)
+      slock_unlock(mapcachelock);
+#endif
+}
+
+static void CAL_MapCachePath (char *path, size_t size)
+{
+   if(configdir[0])
+      snprintf(path, size, "%s/%s%s", configdir, mcachename, extension);
+   else
+      snprintf(path, size, "%s%s", mcachename, extension);
+}
+
+/*
+======================
+=
+= CAL_LoadMapCache
+=
+= Loads the maps from mapcache.ext that were expanded from the same
+= gamemaps file and map headers
+=
+======================
+*/
+
+static void CAL_LoadMapCache (void)
+{
+   char           path[300];
+   mapcacheheader head;
+   maptype        maphead;
+   int            handle, i;
+
+   CAL_MapCachePath(path, sizeof(path));
+   handle = open(path, O_RDONLY | O_BINARY);
+   if (handle == -1)
+      return;
+
+   if (read(handle, &head, sizeof(head)) != sizeof(head)
+         || head.version != MAPCACHEVERSION || head.nummaps != NUMMAPS
+         || head.numplanes != MAPPLANES || head.maparea_ != maparea
+         || head.filesize != mapfilesize || head.filemtime != mapfilemtime
+         || head.rlewtag != RLEWtag)
+   {
+      close(handle);
+      return;
+   }
+
+   /* every map is its header followed by its planes, if it has any */
+   for (i = 0; i < NUMMAPS; i++)
+   {
+      word *planes;
+
+      if (read(handle, &maphead, sizeof(maphead)) != sizeof(maphead))
+         break;
+      if (!maphead.width)
+         continue;
+
+      if (!mapheaderseg[i] || memcmp(&maphead, mapheaderseg[i], sizeof(maphead)))
+      {
+         lseek(handle, MAPPLANES*maparea*2, SEEK_CUR);
+         continue;
+      }
+
+      planes = (word *) malloc(MAPPLANES*maparea*2);
+      CHECKMALLOCRESULT(planes);
+      if (read(handle, planes, MAPPLANES*maparea*2) != MAPPLANES*maparea*2)
+      {
+         free(planes);
+         break;
+      }
+      mapcache[i] = planes;
+   }
+
+   close(handle);
+}
+
+/*
+======================
+=
+= CAL_SaveMapCache
+=
+= Writes the maps expanded so far to mapcache.ext, if there are new ones
+=
+======================
+*/
+
+static void CAL_SaveMapCache (void)
+{
+   char           path[300];
+   mapcacheheader head;
+   maptype        nomap;
+   word          *planes[NUMMAPS];
+   boolean        dirty;
+   int            handle, i;
+
+#ifdef HAVE_THREADS
+   if (mapcachelock)
+      slock_lock(mapcachelock);
+#endif
+   memcpy(planes, mapcache, sizeof(planes));
+   dirty = mapcachedirty;
+   mapcachedirty = false;
+#ifdef HAVE_THREADS
+   if (mapcachelock)
+      slock_unlock(mapcachelock);
+#endif
+
+   if (!dirty)
+      return;
+
+   CAL_MapCachePath(path, sizeof(path));
+   handle = open(path, O_CREAT | O_WRONLY | O_TRUNC | O_BINARY, 0644);
+   if (handle == -1)
+      return;
+
+   memset(&head, 0, sizeof(head));
+   head.version   = MAPCACHEVERSION;
+   head.nummaps   = NUMMAPS;
+   head.numplanes = MAPPLANES;
+   head.maparea_  = maparea;
+   head.filesize  = mapfilesize;
+   head.filemtime = mapfilemtime;
+   head.rlewtag   = RLEWtag;
+   write(handle, &head, sizeof(head));
+
+   memset(&nomap, 0, sizeof(nomap));
+   for (i = 0; i < NUMMAPS; i++)
+   {
+      if (planes[i] && mapheaderseg[i])
+      {
+         write(handle, mapheaderseg[i], sizeof(maptype));
+         write(handle, planes[i], MAPPLANES*maparea*2);
+      }
+      else
+         write(handle, &nomap, sizeof(nomap));
+   }
+
+   close(handle);
+}
+
+#ifdef HAVE_THREADS
+static word *mapcacheplanes;    /* the map the thread is expanding */
+
+static void CAL_ExpandAllMaps (void *data)
+{
+   static int32_t buffer[BUFFERSIZE/4];
+   word  *dest[MAPPLANES];
+   vfile *handle = (vfile *) data;
+   int    mapnum, plane;
+
+   for (mapnum = 0; mapnum < NUMMAPS && !mapcachequit; mapnum++)
+   {
+      if (!mapheaderseg[mapnum] || CAL_CachedMapPlanes(mapnum))
+         continue;
+
+      mapcacheplanes = (word *) malloc(MAPPLANES*maparea*2);
+      if (!mapcacheplanes)
+         break;
+      for (plane = 0; plane<MAPPLANES; plane++)
+         dest[plane] = mapcacheplanes + plane*maparea;
+
+      LR_TRACE_BEGIN("CAL_ExpandMapPlanes");
+      CAL_ExpandMapPlanes(handle, mapnum, dest, buffer);
+      LR_TRACE_END("CAL_ExpandMapPlanes");
+
+      CAL_StoreMapPlanes(mapnum, mapcacheplanes);
+      mapcacheplanes = NULL;
+   }
+}
+
+/*
+ * A Quit while expanding only stops the thread, CA_CacheMap expands the
+ * maps it did not get to on the game thread, which quits properly.
+ */
+static void CAL_MapCacheThread (void *data)
+{
+   vfile *handle;
+   char   error[256];
+
+   LR_TraceThreadName("mapcache");
+
+   /* its own handle, CA_CacheMap reads maphandle meanwhile */
+   handle = VF_Open(mapfname);
+   if (!handle)
+      return;
+
+   if (LR_TaskCatch(CAL_ExpandAllMaps, handle, error, sizeof(error)))
+   {
+      printf("Map cache: %s\n", error);
+      free(mapcacheplanes);
+      mapcacheplanes = NULL;
+   }
+
+   VF_Close(handle);
+
+   if (mapcachefile && !mapcachequit)
+      CAL_SaveMapCache();
+}
+#endif
+
+/*
+======================
+=
+= CAL_StartMapCache
+=
+= Loads the map cache file and starts expanding the maps that are not
+= in it in the background
+=
+======================
+*/
+
+static void CAL_StartMapCache (void)
+{
+   struct stat st;
+
+   /* the pack has all maps expanded already */
+   if (!param_mapcache || pack)
+      return;
+
+   /* a mounted gamemaps file has no time to check mapcache.ext against */
+   if (param_mapcache == MAPCACHE_DISK && !VF_Memory(maphandle) && stat(mapfname, &st) == 0)
+   {
+      mapfilesize  = st.st_size;
+      mapfilemtime = st.st_mtime;
+      mapcachefile = true;
+      CAL_LoadMapCache();
+   }
+
+#ifdef HAVE_THREADS
+   mapcachelock = slock_new();
+   if (!mapcachelock)
+      return;
+
+   mapcachequit   = false;
+   mapcachethread = sthread_create(CAL_MapCacheThread, NULL);
+#endif
+}
+
+static void CAL_StopMapCache (void)
+{
+   int i;
+
+#ifdef HAVE_THREADS
+   if (mapcachethread)
+   {
+      mapcachequit = true;
+      sthread_join(mapcachethread);
+      mapcachethread = NULL;
+   }
+#endif
+
+   if (mapcachefile)
+      CAL_SaveMapCache();
+
+#ifdef HAVE_THREADS
+   slock_free(mapcachelock);
+   mapcachelock = NULL;
+#endif
+
+   for (i = 0; i < NUMMAPS; i++)
+   {
+      free(mapcache[i]);
+      mapcache[i] = NULL;
+   }
+   mapcachedirty = false;
+   mapcachefile  = false;
 }
 
 
@@ -638,6 +1191,9 @@ void CAL_SetupAudioFile (void)
 {
    char fname[13];
 
+   if (pack)
+      return;
+
    /* load audiohed.ext (offsets for audio file) */
    strcpy(fname,aheadname);
    strcat(fname,audioext);
@@ -651,8 +1207,8 @@ void CAL_SetupAudioFile (void)
    strcpy(fname,afilename);
    strcat(fname,audioext);
 
-   audiohandle = open(fname, O_RDONLY | O_BINARY);
-   if (audiohandle == -1)
+   audiohandle = VF_Open(fname);
+   if (!audiohandle)
       CA_CannotOpen(fname);
 }
 
@@ -679,6 +1235,7 @@ void CA_Startup (void)
     CAL_SetupMapFile ();
     CAL_SetupGrFile ();
     CAL_SetupAudioFile ();
+    CAL_StartMapCache ();
 
     mapon = -1;
 }
@@ -700,12 +1257,12 @@ void CA_Shutdown (void)
 {
     int i,start;
 
-    if(maphandle != -1)
-        close(maphandle);
-    if(grhandle != -1)
-        close(grhandle);
-    if(audiohandle != -1)
-        close(audiohandle);
+    CAL_StopMapCache();
+
+    VF_Close(maphandle);
+    VF_Close(grhandle);
+    VF_Close(audiohandle);
+    maphandle = grhandle = audiohandle = NULL;
 
     for(i=0; i<NUMCHUNKS; i++)
         UNCACHEGRCHUNK(i);
@@ -739,8 +1296,19 @@ void CA_Shutdown (void)
 
 int32_t CA_CacheAudioChunk (int chunk)
 {
-    int32_t pos  = Retro_SwapLES32(audiostarts[chunk]);
-    int32_t size = Retro_SwapLES32(audiostarts[chunk+1]) -pos;
+    int32_t pos, size;
+
+    if (pack)
+    {
+        packentry entry = PK_Entry(pack->sounds, chunk);
+
+        if (!audiosegs[chunk])
+            audiosegs[chunk] = CAL_CopyFromPack(entry);
+        return entry.size;
+    }
+
+    pos  = Retro_SwapLES32(audiostarts[chunk]);
+    size = Retro_SwapLES32(audiostarts[chunk+1]) -pos;
 
     /* already in memory */
     if (audiosegs[chunk])
@@ -749,28 +1317,34 @@ int32_t CA_CacheAudioChunk (int chunk)
     audiosegs[chunk]=(byte *) malloc(size);
     CHECKMALLOCRESULT(audiosegs[chunk]);
 
-    lseek(audiohandle,pos,SEEK_SET);
-    read(audiohandle,audiosegs[chunk],size);
+    VF_Seek(audiohandle,pos);
+    VF_Read(audiohandle,audiosegs[chunk],size);
 
     return size;
 }
 
 void CA_CacheAdlibSoundChunk (int chunk)
 {
-    int32_t pos  = Retro_SwapLES32(audiostarts[chunk]);
-    int32_t size = Retro_SwapLES32(audiostarts[chunk+1]) - pos;
+    int32_t pos, size;
 
     /* already in memory */
     if (audiosegs[chunk])
         return;                        
 
-    lseek(audiohandle, pos, SEEK_SET);
-    read(audiohandle, bufferseg, ORIG_ADLIBSOUND_SIZE - 1);   /* without data[1] */
+    if (pack)
+    {
+        audiosegs[chunk] = CAL_CopyFromPack(PK_Entry(pack->sounds, chunk));
+        return;
+    }
+
+    pos  = Retro_SwapLES32(audiostarts[chunk]);
+    size = Retro_SwapLES32(audiostarts[chunk+1]) - pos;
+
+    byte *ptr = (byte *) VF_Span(audiohandle, pos, ORIG_ADLIBSOUND_SIZE - 1, bufferseg);   /* without data[1] */
 
     AdLibSound *sound = (AdLibSound *) malloc(size + sizeof(AdLibSound) - ORIG_ADLIBSOUND_SIZE);
     CHECKMALLOCRESULT(sound);
 
-    byte *ptr = (byte *) bufferseg;
     sound->common.length = READLONGWORD(&ptr);
     sound->common.priority = READWORD(&ptr);
     sound->inst.mChar = *ptr++;
@@ -791,7 +1365,7 @@ void CA_CacheAdlibSoundChunk (int chunk)
     sound->inst.unused[2] = *ptr++;
     sound->block = *ptr++;
 
-    read(audiohandle, sound->data, size - ORIG_ADLIBSOUND_SIZE + 1);  /* + 1 because of byte data[1] */
+    VF_Read(audiohandle, sound->data, size - ORIG_ADLIBSOUND_SIZE + 1);  /* + 1 because of byte data[1] */
 
     audiosegs[chunk]=(byte *) sound;
 }
@@ -862,14 +1436,15 @@ cachein:
 /*
 ======================
 =
-= CAL_ExpandGrChunk
+= CAL_GrChunkExpandedLength
 =
-= Does whatever is needed with a pointer to a compressed chunk
+= Returns the size chunk expands to, and skips the explicit size in front
+= of its compressed data where it has one
 =
 ======================
 */
 
-void CAL_ExpandGrChunk (int chunk, int32_t *source)
+static int32_t CAL_GrChunkExpandedLength (int chunk, const byte **source)
 {
     int32_t    expanded;
 
@@ -898,15 +1473,38 @@ void CAL_ExpandGrChunk (int chunk, int32_t *source)
     else
     {
         /* everything else has an explicit size longword */
-        expanded = Retro_SwapLES32(*source++);
+        memcpy(&expanded, *source, sizeof(expanded));
+        expanded = Retro_SwapLES32(expanded);
+        *source += sizeof(expanded);
     }
 
+    return expanded;
+}
+
+/*
+======================
+=
+= CAL_ExpandGrChunk
+=
+= Does whatever is needed with a pointer to a compressed chunk
+=
+======================
+*/
+
+void CAL_ExpandGrChunk (int chunk, const byte *source, int32_t compressed)
+{
+    const byte *data     = source;
+    int32_t     expanded = CAL_GrChunkExpandedLength(chunk, &data);
+
+    compressed -= data - source;
+
     /*
      * allocate final space, decompress it, and free bigbuffer.
      * Sprites need to have shifts made and various other junk. */
     grsegs[chunk]=(byte *) malloc(expanded);
     CHECKMALLOCRESULT(grsegs[chunk]);
-    CAL_HuffExpand((byte *) source, grsegs[chunk], expanded, grhuffman);
+    grsizes[chunk]=expanded;
+    CAL_HuffExpand(data, compressed, grsegs[chunk], expanded, grhuffman, grhufftable);
 }
 
 
@@ -923,16 +1521,30 @@ void CAL_ExpandGrChunk (int chunk, int32_t *source)
 void CA_CacheGrChunk (int chunk)
 {
    int32_t pos,compressed;
-   int32_t *source;
+   const byte *source;
+   memptr  bigbufferseg = NULL;
    int  next;
 
    /* already in memory */
    if (grsegs[chunk])
       return;
 
+   if (pack)
+   {
+      packentry entry = PK_Entry(pack->chunks, chunk);
+
+      /* sparse tile */
+      if (!entry.size)
+         return;
+
+      grsegs[chunk]  = CAL_CopyFromPack(entry);
+      grsizes[chunk] = entry.size;
+      return;
+   }
+
    /* load the chunk into a buffer, 
     * either the miscbuffer if it fits, or allocate
-    * a larger buffer. */
+    * a larger buffer.  Mounted files need neither. */
    pos = GRFILEPOS(chunk);
 
    /* $FFFFFFFF start is a sparse tile */
@@ -947,24 +1559,21 @@ void CA_CacheGrChunk (int chunk)
 
    compressed = GRFILEPOS(next)-pos;
 
-   lseek(grhandle,pos,SEEK_SET);
+   LR_TRACE_BEGIN("CA_CacheGrChunk");
 
-   if (compressed<=BUFFERSIZE)
-   {
-      read(grhandle,bufferseg,compressed);
-      source = bufferseg;
-   }
-   else
+   if (compressed>BUFFERSIZE && !VF_InMemory(grhandle,pos,compressed))
    {
-      source = (int32_t *) malloc(compressed);
-      CHECKMALLOCRESULT(source);
-      read(grhandle,source,compressed);
+      bigbufferseg=malloc(compressed);
+      CHECKMALLOCRESULT(bigbufferseg);
    }
 
-   CAL_ExpandGrChunk (chunk,source);
+   source = (const byte *) VF_Span(grhandle,pos,compressed,bigbufferseg ? bigbufferseg : bufferseg);
+
+   CAL_ExpandGrChunk (chunk,source,compressed);
+
+   free(bigbufferseg);
 
-   if (compressed>BUFFERSIZE)
-      free(source);
+   LR_TRACE_END("CA_CacheGrChunk");
 }
 
 
@@ -984,37 +1593,51 @@ void CA_CacheGrChunk (int chunk)
 void CA_CacheScreen (int chunk)
 {
    int32_t    pos,compressed,expanded;
-   memptr  bigbufferseg;
-   int32_t    *source;
+   memptr  bigbufferseg = NULL;
+   const byte *source;
    int         next;
    unsigned   x, y, scx, scy;
    unsigned   i, j;
    byte *vbuf = NULL;
+   const byte *pic;
+   byte *picbuffer = NULL;
 
-   /* load the chunk into a buffer */
-   pos = GRFILEPOS(chunk);
-   next = chunk +1;
-   
-   /* skip past any sparse tiles */
-   while (GRFILEPOS(next) == -1)           
-      next++;
-   compressed = GRFILEPOS(next)-pos;
+   if (pack)
+   {
+      packentry entry = PK_Entry(pack->chunks, chunk);
+
+      if (entry.size < 64000)
+         Quit("CA_CacheScreen: Chunk %i is not a screen!", chunk);
+      pic = (const byte *) PK_Data(entry);
+   }
+   else
+   {
+      /* load the chunk into a buffer */
+      pos = GRFILEPOS(chunk);
+      next = chunk +1;
 
-   lseek(grhandle,pos,SEEK_SET);
+      /* skip past any sparse tiles */
+      while (GRFILEPOS(next) == -1)
+         next++;
+      compressed = GRFILEPOS(next)-pos;
 
-   bigbufferseg=malloc(compressed);
-   CHECKMALLOCRESULT(bigbufferseg);
-   read(grhandle,bigbufferseg,compressed);
-   source = (int32_t *) bigbufferseg;
+      if (!VF_InMemory(grhandle,pos,compressed))
+      {
+         bigbufferseg=malloc(compressed);
+         CHECKMALLOCRESULT(bigbufferseg);
+      }
+      source = (const byte *) VF_Span(grhandle,pos,compressed,bigbufferseg);
 
-   expanded = Retro_SwapLES32(*source++);
+      expanded = CAL_GrChunkExpandedLength(chunk, &source);
 
-   /*
-    * allocate final space, decompress it, and free bigbuffer
-    * Sprites need to have shifts made and various other junk. */
-   byte *pic = (byte *) malloc(64000);
-   CHECKMALLOCRESULT(pic);
-   CAL_HuffExpand((byte *) source, pic, expanded, grhuffman);
+      /*
+       * allocate final space, decompress it, and free bigbuffer
+       * Sprites need to have shifts made and various other junk. */
+      picbuffer = (byte *) malloc(64000);
+      CHECKMALLOCRESULT(picbuffer);
+      CAL_HuffExpand(source, compressed - 4, picbuffer, expanded, grhuffman, grhufftable);
+      pic = picbuffer;
+   }
 
    vbuf = VL_LockSurface(screenBuffer);
    for(y = 0, scy = 0; y < 200; y++, scy += scaleFactor)
@@ -1028,7 +1651,7 @@ void CA_CacheScreen (int chunk)
       }
    }
    VL_UnlockSurface(screenBuffer);
-   free(pic);
+   free(picbuffer);
    free(bigbufferseg);
 }
 
@@ -1037,70 +1660,276 @@ void CA_CacheScreen (int chunk)
 /*
 ======================
 =
-= CA_CacheMap
+= CA_HuffBenchmark
 =
-= WOLF: This is specialized for a 64*64 map size
+= Expands every graphics chunk HUFFBENCHPASSES times with the tree walk
+= and with the lookup table, checks that both give the same bytes and
+= prints how long they took
 =
 ======================
 */
 
-void CA_CacheMap (int mapnum)
+#define HUFFBENCHPASSES 20
+
+typedef struct
 {
-   int32_t   pos,compressed;
-   int       plane;
-   word     *dest;
-   memptr    bigbufferseg;
-   unsigned  size;
-   word     *source;
-#ifdef CARMACIZED
-   word     *buffer2seg;
-   int32_t   expanded;
-#endif
+   int      chunk;
+   byte    *buffer, *source;
+   int32_t  compressed, expanded;
+   byte    *tree, *table;
+} huffbenchchunk;
 
-   mapon = mapnum;
+void CA_HuffBenchmark (void)
+{
+   huffbenchchunk *chunks, *hc;
+   int      chunk, next, numchunks = 0, pass, i;
+   int32_t  pos, totalcompressed = 0, totalexpanded = 0;
+   uint64_t start, treetime, tabletime;
+   word     nodeval = 254 + 256;
+   int      zerobits = 0;
+
+   chunks = (huffbenchchunk *) calloc(NUMCHUNKS, sizeof(*chunks));
+   CHECKMALLOCRESULT(chunks);
+
+   /* how many zero bits make up one code, see below */
+   while (nodeval >= 256 && zerobits < 256)
+   {
+      nodeval = grhuffman[nodeval - 256].bit0;
+      zerobits++;
+   }
 
-   /* load the planes into the allready allocated buffers */
-   size = maparea*2;
+   /* read everything first, so only the decoding is timed */
+   for (chunk = STRUCTPIC; chunk < NUMCHUNKS; chunk++)
+   {
+      const byte *data, *start;
+      int         skip;
 
-   for (plane = 0; plane<MAPPLANES; plane++)
+      pos = GRFILEPOS(chunk);
+      if (pos < 0)
+         continue;
+
+      next = chunk + 1;
+      while (GRFILEPOS(next) == -1)
+         next++;
+
+      hc = &chunks[numchunks];
+      hc->compressed = GRFILEPOS(next) - pos;
+      if (hc->compressed <= 0)
+         continue;
+
+      start        = (const byte *) VF_Span(grhandle, pos, 4, bufferseg);
+      data         = start;
+      hc->chunk    = chunk;
+      hc->expanded = CAL_GrChunkExpandedLength(chunk, &data);
+      skip         = data - start;
+      if (hc->expanded <= 0)
+         continue;
+
+      /*
+       * Some chunks run out of codes before they are fully expanded.  The
+       * tree walk then reads on past them, CAL_HuffExpand decodes zero bits,
+       * so give the tree walk enough zeros to decode the whole chunk from.
+       */
+      hc->buffer = (byte *) calloc(hc->compressed + ((int64_t) hc->expanded * zerobits + 7) / 8 + 1, 1);
+      CHECKMALLOCRESULT(hc->buffer);
+      VF_Seek(grhandle, pos);
+      VF_Read(grhandle, hc->buffer, hc->compressed);
+
+      hc->source      = hc->buffer + skip;
+      hc->compressed -= skip;
+
+      hc->tree  = (byte *) malloc(hc->expanded);
+      hc->table = (byte *) malloc(hc->expanded);
+      CHECKMALLOCRESULT(hc->tree);
+      CHECKMALLOCRESULT(hc->table);
+
+      totalcompressed += hc->compressed;
+      totalexpanded   += hc->expanded;
+      numchunks++;
+   }
+
+   start = LR_GetMicroTicks();
+   for (pass = 0; pass < HUFFBENCHPASSES; pass++)
+      for (i = 0; i < numchunks; i++)
+         CAL_HuffExpandTree(chunks[i].source, chunks[i].tree, chunks[i].expanded, grhuffman);
+   treetime = LR_GetMicroTicks() - start;
+
+   start = LR_GetMicroTicks();
+   for (pass = 0; pass < HUFFBENCHPASSES; pass++)
+      for (i = 0; i < numchunks; i++)
+         CAL_HuffExpand(chunks[i].source, chunks[i].compressed, chunks[i].table,
+               chunks[i].expanded, grhuffman, grhufftable);
+   tabletime = LR_GetMicroTicks() - start;
+
+   for (i = 0; i < numchunks; i++)
    {
-      pos = mapheaderseg[mapnum]->planestart[plane];
-      compressed = mapheaderseg[mapnum]->planelength[plane];
+      if (memcmp(chunks[i].tree, chunks[i].table, chunks[i].expanded))
+         Quit("CA_HuffBenchmark: The lookup table decodes chunk %i differently!", chunks[i].chunk);
+   }
 
-      dest = mapsegs[plane];
+   printf("huffbench: %i chunks, %i KB compressed, %i KB expanded, %i passes\n",
+         numchunks, totalcompressed / 1024, totalexpanded / 1024, HUFFBENCHPASSES);
+   printf("   tree walk    %.3f ms per pass, %.1f MB/s\n", treetime / 1000.0 / HUFFBENCHPASSES,
+         treetime ? (double) totalexpanded * HUFFBENCHPASSES / treetime : 0.0);
+   printf("   lookup table %.3f ms per pass, %.1f MB/s, %.2fx\n", tabletime / 1000.0 / HUFFBENCHPASSES,
+         tabletime ? (double) totalexpanded * HUFFBENCHPASSES / tabletime : 0.0,
+         tabletime ? (double) treetime / tabletime : 0.0);
 
-      lseek(maphandle,pos,SEEK_SET);
-      if (compressed<=BUFFERSIZE)
-         source = (word *) bufferseg;
-      else
+   for (i = 0; i < numchunks; i++)
+   {
+      free(chunks[i].buffer);
+      free(chunks[i].tree);
+      free(chunks[i].table);
+   }
+   free(chunks);
+}
+
+/*
+======================
+=
+= CA_WritePack
+=
+= Writes the pic table, every graphics chunk and map expanded and every
+= audio chunk (the AdLib sounds converted to AdLibSound) to the pack
+= being built
+=
+======================
+*/
+
+void CA_WritePack (FILE *file, packheader *head)
+{
+   packentry *entries;
+   word      *planes;
+   int        i, plane;
+   boolean    cached;
+
+   head->numchunks    = NUMCHUNKS;
+   head->numpics      = NUMPICS;
+   head->nummaps      = NUMMAPS;
+   head->numsndchunks = NUMSNDCHUNKS;
+
+   head->pictable = PK_Write(file, pictable, NUMPICS*sizeof(pictabletype));
+
+   entries = (packentry *) calloc(NUMCHUNKS, sizeof(packentry));
+   CHECKMALLOCRESULT(entries);
+   for (i = 0; i < NUMCHUNKS; i++)
+   {
+      cached = grsegs[i] != NULL;
+      CA_CacheGrChunk(i);
+      if (!grsegs[i])
+         continue;                   /* sparse tile */
+
+      entries[i] = PK_Write(file, grsegs[i], grsizes[i]);
+      if (!cached)
+         UNCACHEGRCHUNK(i);
+   }
+   head->chunks = PK_Write(file, entries, NUMCHUNKS*sizeof(packentry));
+   free(entries);
+
+   /* a map is its header followed by its planes */
+   entries = (packentry *) calloc(NUMMAPS, sizeof(packentry));
+   CHECKMALLOCRESULT(entries);
+   planes = (word *) malloc(MAPPLANES*maparea*2);
+   CHECKMALLOCRESULT(planes);
+   for (i = 0; i < NUMMAPS; i++)
+   {
+      if (!mapheaderseg[i])
+         continue;
+
+      CA_CacheMap(i);
+      for (plane = 0; plane<MAPPLANES; plane++)
+         memcpy(planes + plane*maparea, mapsegs[plane], maparea*2);
+
+      entries[i] = PK_Write(file, mapheaderseg[i], sizeof(maptype));
+      fwrite(planes, 1, MAPPLANES*maparea*2, file);
+      entries[i].size += MAPPLANES*maparea*2;
+   }
+   head->maps = PK_Write(file, entries, NUMMAPS*sizeof(packentry));
+   free(planes);
+   free(entries);
+
+   entries = (packentry *) calloc(NUMSNDCHUNKS, sizeof(packentry));
+   CHECKMALLOCRESULT(entries);
+   for (i = 0; i < NUMSNDCHUNKS; i++)
+   {
+      int32_t size = Retro_SwapLES32(audiostarts[i+1]) - Retro_SwapLES32(audiostarts[i]);
+      byte   *data = audiosegs[i];
+
+      cached = data != NULL;
+      if (i >= STARTADLIBSOUNDS && i < STARTADLIBSOUNDS + NUMSOUNDS)
       {
-         bigbufferseg=malloc(compressed);
-         CHECKMALLOCRESULT(bigbufferseg);
-         source = (word *) bigbufferseg;
+         /* the loaded one may be the raw chunk while PC sounds are active */
+         audiosegs[i] = NULL;
+         CA_CacheAdlibSoundChunk(i);
+         size += sizeof(AdLibSound) - ORIG_ADLIBSOUND_SIZE;
       }
+      else if (!cached)
+         CA_CacheAudioChunk(i);
 
-      read(maphandle,source,compressed);
-#ifdef CARMACIZED
-      // unhuffman, then unRLEW
-      // The huffman'd chunk has a two byte expanded length first
-      // The resulting RLEW chunk also does, even though it's not really
-      // needed
-      expanded = Retro_SwapLES16(*source);
-      source++;
-      buffer2seg = (word *) malloc(expanded);
-      CHECKMALLOCRESULT(buffer2seg);
-      CAL_CarmackExpand((byte *) source, buffer2seg,expanded);
-      CA_RLEWexpand(buffer2seg+1,dest,size,RLEWtag);
-      free(buffer2seg);
+      entries[i] = PK_Write(file, audiosegs[i], size);
+      if (audiosegs[i] != data)
+         UNCACHEAUDIOCHUNK(i);
+      audiosegs[i] = data;
+   }
+   head->sounds = PK_Write(file, entries, NUMSNDCHUNKS*sizeof(packentry));
+   free(entries);
 
-#else
-      /* unRLEW, skipping expanded length */
-      CA_RLEWexpand (source+1,dest,size,RLEWtag);
-#endif
+   mapon = -1;
+}
+
+//==========================================================================
+
+/*
+======================
+=
+= CA_CacheMap
+=
+= WOLF: This is specialized for a 64*64 map size
+=
+======================
+*/
+
+void CA_CacheMap (int mapnum)
+{
+   int    plane;
+   word  *planes;
+
+   LR_TRACE_BEGIN("CA_CacheMap");
+
+   mapon = mapnum;
+
+   if (pack)
+   {
+      packentry entry = PK_Entry(pack->maps, mapnum);
+
+      if (entry.size != sizeof(maptype) + MAPPLANES*maparea*2)
+         Quit("CA_CacheMap: Map %i is not in the pack!", mapnum);
+      planes = (word *) ((const maptype *) PK_Data(entry) + 1);
+   }
+   else
+      planes = CAL_CachedMapPlanes(mapnum);
+
+   if (planes)
+   {
+      for (plane = 0; plane<MAPPLANES; plane++)
+         memcpy(mapsegs[plane], planes + plane*maparea, maparea*2);
+   }
+   else
+   {
+      /* load the planes into the allready allocated buffers */
+      CAL_ExpandMapPlanes(maphandle, mapnum, mapsegs, bufferseg);
 
-      if (compressed>BUFFERSIZE)
-         free(bigbufferseg);
+      if (param_mapcache)
+      {
+         planes = (word *) malloc(MAPPLANES*maparea*2);
+         CHECKMALLOCRESULT(planes);
+         for (plane = 0; plane<MAPPLANES; plane++)
+            memcpy(planes + plane*maparea, mapsegs[plane], maparea*2);
+         CAL_StoreMapPlanes(mapnum, planes);
+      }
    }
+
+   LR_TRACE_END("CA_CacheMap");
 }
 
 //===========================================================================
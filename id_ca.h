@@ -50,6 +50,8 @@ void CA_CacheGrChunk (int chunk);
 void CA_CacheMap (int mapnum);
 
 void CA_CacheScreen (int chunk);
+void CA_HuffBenchmark (void);
+void CA_WritePack (FILE *file, packheader *head);
 
 void CA_CannotOpen(const char *name);
 
@@ -154,6 +154,7 @@ boolean IN_JoyPresent(void)
    return false;
 }
 
+#ifndef __LIBRETRO__
 static void processEvent(SDL_Event *event)
 {
    switch (event->type)
@@ -273,6 +274,56 @@ static void processEvent(SDL_Event *event)
    }
 }
 
+#endif
+
+#ifdef __LIBRETRO__
+/*
+ * The frontend reports key changes from retro_run through IN_KeyEvent
+ * while the game thread waits, so there is nothing to poll here.
+ */
+void IN_KeyEvent(int key, boolean pressed)
+{
+   int sym = key;
+
+   if(key <= 0 || key >= SDLK_LAST)
+      return;
+
+   if(!pressed)
+   {
+      Keyboard[key] = 0;
+      return;
+   }
+
+   LastScan = key;
+
+   if(sym >= 'a' && sym <= 'z')
+      sym -= 32;  // convert to uppercase
+
+   if(Keyboard[sc_LShift] || Keyboard[sc_RShift])
+   {
+      if(sym < lengthof(ShiftNames) && ShiftNames[sym])
+         LastASCII = ShiftNames[sym];
+   }
+   else
+   {
+      if(sym < lengthof(ASCIINames) && ASCIINames[sym])
+         LastASCII = ASCIINames[sym];
+   }
+
+   Keyboard[key] = 1;
+   if(key == SDLK_PAUSE)
+      Paused = true;
+}
+
+void IN_WaitAndProcessEvents()
+{
+   LR_YieldFrame();
+}
+
+void IN_ProcessEvents()
+{
+}
+#else
 void IN_WaitAndProcessEvents()
 {
    SDL_Event event;
@@ -295,6 +346,7 @@ void IN_ProcessEvents()
       processEvent(&event);
    }
 }
+#endif
 
 ///////////////////////////////////////////////////////////////////////////
 //
@@ -498,7 +550,7 @@ boolean IN_UserInput(longword delay)
       IN_ProcessEvents();
       if (IN_CheckAck())
          return true;
-      rarch_sleep(5);
+      LR_Delay(5);
    } while (GetTimeCount() - lasttime < delay);
    return(false);
 }
@@ -165,6 +165,9 @@ extern  const char *IN_GetScanName(ScanCode);
 
 void    IN_WaitAndProcessEvents();
 void    IN_ProcessEvents();
+#ifdef __LIBRETRO__
+void    IN_KeyEvent(int key, boolean pressed);
+#endif
 
 int     IN_MouseButtons (void);
 
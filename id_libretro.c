@@ -6,19 +6,212 @@
 
 LR_Color curpal[256];
 
+#ifdef __LIBRETRO__
+/* the frame handed to the frontend, it lives as long as the video does */
+#ifdef FRONTEND_SUPPORTS_RGB565
+#define SCREENBITS   16
+#define SCREENRMASK  0xf800
+#define SCREENGMASK  0x07e0
+#define SCREENBMASK  0x001f
+#else
+#define SCREENBITS   32
+#define SCREENRMASK  0xff0000
+#define SCREENGMASK  0x00ff00
+#define SCREENBMASK  0x0000ff
+#endif
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__) && !defined(__ARM_BIG_ENDIAN)
+#include <arm_neon.h>
+#define NEON_SCREENLUT
+#endif
+
+/*
+=============================================================================
+
+                        PALETTE CONVERSION STAGE
+
+screenBuffer is drawn with palette indices, the screen surface is 16 or 32
+bit.  screenlut holds the screen pixel for every palette index and is only
+rebuilt when the palette or the screen format changes, so presenting a frame
+is a plain table lookup per pixel instead of a trip through the SDL blitter.
+
+=============================================================================
+*/
+
+static uint16_t screenlut16[256];
+static uint32_t screenlut32[256];
+static SDL_PixelFormat *screenlutformat;     // NULL when the table is stale
+
+#ifdef NEON_SCREENLUT
+static uint8x16x4_t screenlutbytes[4][4];    // [byte of the pixel][64 entry quarter]
+#endif
+
+static void VL_BuildScreenLUT (SDL_PixelFormat *format)
+{
+   int i;
+
+   for (i = 0; i < 256; i++)
+   {
+      screenlut32[i] = LR_MapRGB(format, curpal[i].r, curpal[i].g, curpal[i].b);
+      screenlut16[i] = (uint16_t)screenlut32[i];
+   }
+
+#ifdef NEON_SCREENLUT
+   {
+      int b, q, t;
+      uint8_t bytes[256];
+
+      for (b = 0; b < 4; b++)
+      {
+         for (i = 0; i < 256; i++)
+            bytes[i] = (uint8_t)(screenlut32[i] >> (b * 8));
+         for (q = 0; q < 4; q++)
+            for (t = 0; t < 4; t++)
+               screenlutbytes[b][q].val[t] = vld1q_u8(bytes + q * 64 + t * 16);
+      }
+   }
+#endif
+
+   screenlutformat = format;
+}
+
+#ifdef NEON_SCREENLUT
+/* indices outside a quarter look up as 0, so the four quarters can be or'ed */
+static inline uint8x16_t LookupScreenBytes (const uint8x16x4_t *quarters, uint8x16_t idx)
+{
+   uint8x16_t res;
+
+   res = vqtbl4q_u8(quarters[0], idx);
+   res = vorrq_u8(res, vqtbl4q_u8(quarters[1], vsubq_u8(idx, vdupq_n_u8(64))));
+   res = vorrq_u8(res, vqtbl4q_u8(quarters[2], vsubq_u8(idx, vdupq_n_u8(128))));
+   res = vorrq_u8(res, vqtbl4q_u8(quarters[3], vsubq_u8(idx, vdupq_n_u8(192))));
+   return res;
+}
+#endif
+
+static void ConvertRow16 (const byte *src, uint16_t *dest, unsigned width)
+{
+   unsigned x = 0;
+
+#ifdef NEON_SCREENLUT
+   for (; x + 16 <= width; x += 16)
+   {
+      uint8x16_t  idx = vld1q_u8(src + x);
+      uint8x16x2_t pix;
+
+      pix.val[0] = LookupScreenBytes(screenlutbytes[0], idx);
+      pix.val[1] = LookupScreenBytes(screenlutbytes[1], idx);
+      vst2q_u8((uint8_t *)(dest + x), pix);
+   }
+#endif
+
+   for (; x + 4 <= width; x += 4)
+   {
+      dest[x]     = screenlut16[src[x]];
+      dest[x + 1] = screenlut16[src[x + 1]];
+      dest[x + 2] = screenlut16[src[x + 2]];
+      dest[x + 3] = screenlut16[src[x + 3]];
+   }
+   for (; x < width; x++)
+      dest[x] = screenlut16[src[x]];
+}
+
+static void ConvertRow32 (const byte *src, uint32_t *dest, unsigned width)
+{
+   unsigned x = 0;
+
+#if defined(__AVX2__)
+   for (; x + 8 <= width; x += 8)
+   {
+      __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + x)));
+      _mm256_storeu_si256((__m256i *)(dest + x),
+            _mm256_i32gather_epi32((const int *)screenlut32, idx, 4));
+   }
+#elif defined(NEON_SCREENLUT)
+   for (; x + 16 <= width; x += 16)
+   {
+      uint8x16_t  idx = vld1q_u8(src + x);
+      uint8x16x4_t pix;
+
+      pix.val[0] = LookupScreenBytes(screenlutbytes[0], idx);
+      pix.val[1] = LookupScreenBytes(screenlutbytes[1], idx);
+      pix.val[2] = LookupScreenBytes(screenlutbytes[2], idx);
+      pix.val[3] = LookupScreenBytes(screenlutbytes[3], idx);
+      vst4q_u8((uint8_t *)(dest + x), pix);
+   }
+#endif
+
+   for (; x + 4 <= width; x += 4)
+   {
+      dest[x]     = screenlut32[src[x]];
+      dest[x + 1] = screenlut32[src[x + 1]];
+      dest[x + 2] = screenlut32[src[x + 2]];
+      dest[x + 3] = screenlut32[src[x + 3]];
+   }
+   for (; x < width; x++)
+      dest[x] = screenlut32[src[x]];
+}
+
+/*
+=================
+=
+= VL_ConvertScreen
+=
+= Converts an 8 bit surface to the 16 or 32 bit surface of the same size,
+= anything else goes through the SDL blitter
+=
+=================
+*/
+
+void VL_ConvertScreen (LR_Surface *source, LR_Surface *dest)
+{
+   SDL_Surface *src = source->surf;
+   SDL_Surface *dst = dest->surf;
+   unsigned bytes   = dst->format->BytesPerPixel;
+   const byte *srcline;
+   byte *destline;
+   int y;
+
+   if (src->format->BitsPerPixel != 8 || (bytes != 2 && bytes != 4)
+         || src->w != dst->w || src->h != dst->h)
+   {
+      VL_ScreenToScreen(source, dest);
+      return;
+   }
+
+   if (screenlutformat != dst->format)
+      VL_BuildScreenLUT(dst->format);
+
+   srcline  = VL_LockSurface(source);
+   destline = VL_LockSurface(dest);
+
+   for (y = 0; y < src->h; y++)
+   {
+      if (bytes == 2)
+         ConvertRow16(srcline, (uint16_t *)destline, src->w);
+      else
+         ConvertRow32(srcline, (uint32_t *)destline, src->w);
+
+      srcline  += src->pitch;
+      destline += dst->pitch;
+   }
+
+   VL_UnlockSurface(dest);
+   VL_UnlockSurface(source);
+}
+
 void VL_WaitVBL(int vbls)
 {
-   rarch_sleep(vbls * 8);
+   LR_Delay(vbls * 8);
 }
 
 void VW_UpdateScreen(void)
 {
-   VL_ScreenToScreen(screenBuffer, screen);
-#ifdef __LIBRETRO__
-   LR_Flip(NULL);
-#else
+   VL_ConvertScreen(screenBuffer, screen);
    LR_Flip(screen);
-#endif
 }
 
 /*
@@ -31,24 +224,32 @@ void VW_UpdateScreen(void)
 
 void    VL_Startup (void)
 {
-#ifndef __LIBRETRO__
    screen     = (LR_Surface*)calloc(1, sizeof(*screen));
+   CHECKMALLOCRESULT(screen);
 
+#ifdef __LIBRETRO__
+   screen->surf     = LR_CreateRGBSurface(SDL_SWSURFACE, screenWidth, screenHeight,
+         SCREENBITS, SCREENRMASK, SCREENGMASK, SCREENBMASK, 0);
+#else
    screen->surf     = LR_SetVideoMode(screenWidth, screenHeight, 16, 0);
+#endif
 
    if(!screen->surf)
-      exit(1);
+      Quit("Unable to set %ix%i video mode", screenWidth, screenHeight);
 
+#ifndef __LIBRETRO__
    LR_SetColors(screen->surf, gamepal, 0, 256);
 #endif
    memcpy(curpal, gamepal, sizeof(LR_Color) * 256);
+   screenlutformat = NULL;
 
    screenBuffer = (LR_Surface*)calloc(1, sizeof(*screenBuffer));
+   CHECKMALLOCRESULT(screenBuffer);
 
    screenBuffer->surf = LR_CreateRGBSurface(SDL_SWSURFACE, screenWidth,
          screenHeight, 8, 0, 0, 0, 0);
    if(!screenBuffer->surf)
-      exit(1);
+      Quit("Unable to create screen buffer surface");
    LR_SetColors(screenBuffer->surf, gamepal, 0, 256);
 
    bufferPitch = screenBuffer->surf->pitch;
@@ -74,13 +275,17 @@ void VL_Shutdown (void)
 {
    if (screenBuffer)
       free(screenBuffer);
-#ifndef __LIBRETRO__
    if (screen)
+   {
+#ifdef __LIBRETRO__
+      LR_FreeSurface(screen->surf);
+#endif
       free(screen);
+   }
 
    screen       = NULL;
-#endif
    screenBuffer = NULL;
+   screenlutformat = NULL;
 }
 
 /*
@@ -93,6 +298,8 @@ void VL_Shutdown (void)
 
 void VL_SetPalette (LR_Color *palette, bool forceupdate)
 {
+   if (memcmp(curpal, palette, sizeof(LR_Color) * 256))
+      screenlutformat = NULL;
    memcpy(curpal, palette, sizeof(LR_Color) * 256);
 
    LR_SetPalette(screenBuffer->surf, SDL_LOGPAL, palette, 0, 256);
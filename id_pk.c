@@ -0,0 +1,369 @@
+// ID_PK.C
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#define PK_CAN_MAP
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define PK_CAN_MAP
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "wl_def.h"
+
+/*
+=============================================================================
+
+                                ASSET PACK
+
+The pack is one file with everything PM_Startup and CA_Startup would
+otherwise read, decompress and byte swap from vswap, vgahead/vgadict/
+vgagraph, maphead/gamemaps and audiohed/audiot.  A mounted pack is used
+where it is, a pack on disk is mapped where the platform can map files
+and read in one go elsewhere.  Every item starts PACKALIGN aligned.
+
+The pack remembers the size and time of the original files, and once any
+of them that is there changed, the original files are used again.
+
+=============================================================================
+*/
+
+static const char pkname[] = "pack.";
+
+packheader *pack;
+
+static size_t  packsize;
+static boolean packmapped, packmounted;
+
+static const struct
+{
+   const char *name;
+   const char *ext;
+} pksources[PACKSOURCES] =
+{
+   { "vswap.",    extension },
+   { "vgahead.",  graphext },
+   { "vgadict.",  graphext },
+   { "vgagraph.", graphext },
+   { "maphead.",  extension },
+   { "gamemaps.", extension },
+   { "audiohed.", audioext },
+   { "audiot.",   audioext },
+};
+
+static void PK_FileName (char *fname)
+{
+   strcpy(fname, pkname);
+   strcat(fname, extension);
+}
+
+static boolean PK_ValidEntry (packentry entry)
+{
+   return entry.offset <= packsize && entry.size <= packsize - entry.offset;
+}
+
+static boolean PK_ValidTable (packentry table, uint32_t count)
+{
+   uint32_t i;
+
+   if (!PK_ValidEntry(table) || table.size != count * sizeof(packentry)
+         || table.offset % sizeof(uint32_t))
+      return false;
+
+   for (i = 0; i < count; i++)
+   {
+      if (!PK_ValidEntry(PK_Entry(table, i)))
+         return false;
+   }
+   return true;
+}
+
+/*
+ * Size and time of original file i.  A mounted file is opened before one on
+ * disk and has no time.
+ */
+static void PK_SourceInfo (int i, packsource *src)
+{
+   char        fname[16];
+   struct stat st;
+   vfile      *file;
+
+   strcpy(fname, pksources[i].name);
+   strcat(fname, pksources[i].ext);
+
+   src->size  = -1;
+   src->mtime = 0;
+
+   file = VF_Open(fname);
+   if (!file)
+      return;
+
+   src->size = VF_Size(file);
+   if (VF_Stream(file) && stat(fname, &st) == 0)
+      src->mtime = st.st_mtime;
+   VF_Close(file);
+}
+
+/*
+===================
+=
+= PK_Current
+=
+= Checks that none of the original files that are there changed since the
+= pack was built.  Missing ones are fine, the pack stands in for them, and
+= mounted ones only have a size to compare.
+=
+===================
+*/
+
+static boolean PK_Current (void)
+{
+   packsource src;
+   int        i;
+
+   for (i = 0; i < PACKSOURCES; i++)
+   {
+      PK_SourceInfo(i, &src);
+      if (src.size == -1)
+         continue;
+
+      if (src.size != pack->sources[i].size
+            || (src.mtime && pack->sources[i].mtime && src.mtime != pack->sources[i].mtime))
+         return false;
+   }
+   return true;
+}
+
+/*
+===================
+=
+= PK_Valid
+=
+= Checks that the pack was built for this executable and that all its
+= entries lie inside it
+=
+===================
+*/
+
+static boolean PK_Valid (void)
+{
+   if (pack->magic != PACKMAGIC || pack->version != PACKVERSION
+         || pack->numchunks != NUMCHUNKS || pack->numpics != NUMPICS
+         || pack->nummaps != NUMMAPS || pack->numsndchunks != NUMSNDCHUNKS)
+      return false;
+
+   if (!pack->numpages || pack->spritestart > pack->soundstart
+         || pack->soundstart >= pack->numpages)
+      return false;
+
+   if (!PK_ValidEntry(pack->pages) || !PK_ValidEntry(pack->pagestarts)
+         || pack->pagestarts.size != (pack->numpages + 1) * sizeof(uint32_t)
+         || pack->pagestarts.offset % sizeof(uint32_t))
+      return false;
+
+   if (!PK_ValidEntry(pack->pictable) || pack->pictable.size != NUMPICS * sizeof(pictabletype))
+      return false;
+
+   return PK_ValidTable(pack->chunks, NUMCHUNKS) && PK_ValidTable(pack->maps, NUMMAPS)
+      && PK_ValidTable(pack->sounds, NUMSNDCHUNKS);
+}
+
+/*
+===================
+=
+= PK_Startup
+=
+= Maps or mounts pack.ext if there is one, returns false to use the
+= original files
+=
+===================
+*/
+
+boolean PK_Startup (void)
+{
+   char   fname[13];
+   vfile *file;
+   long   size;
+
+   PK_FileName(fname);
+
+   file = VF_Open(fname);
+   if (!file)
+      return false;
+
+   size = VF_Size(file);
+   if (size < (long) sizeof(packheader))
+   {
+      VF_Close(file);
+      return false;
+   }
+   packsize = size;
+
+   /* the header is read as words and 64-bit times, copy it if it can't be */
+   if (VF_Memory(file) && !((uintptr_t) VF_Memory(file) % sizeof(int64_t)))
+   {
+      pack        = (packheader *) VF_Memory(file);
+      packmounted = true;
+   }
+#ifdef PK_CAN_MAP
+   else if (VF_Stream(file))
+   {
+      FILE *stream = VF_Stream(file);
+
+#ifdef _WIN32
+      HANDLE mapping = CreateFileMapping((HANDLE) _get_osfhandle(_fileno(stream)),
+            NULL, PAGE_READONLY, 0, 0, NULL);
+      if (mapping)
+      {
+         pack = (packheader *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+         CloseHandle(mapping);       // the view keeps the mapping alive
+      }
+#else
+      void *base = mmap(NULL, packsize, PROT_READ, MAP_SHARED, fileno(stream), 0);
+      if (base != MAP_FAILED)
+         pack = (packheader *) base;
+#endif
+      packmapped = pack != NULL;
+   }
+#endif
+
+   if (!pack)
+   {
+      pack = (packheader *) malloc(packsize);
+      CHECKMALLOCRESULT(pack);
+      VF_Seek(file, 0);
+      if (VF_Read(file, pack, packsize) != (long) packsize)
+      {
+         free(pack);
+         pack = NULL;
+      }
+   }
+   VF_Close(file);
+
+   if (!pack)
+      return false;
+
+   if (!PK_Valid())
+   {
+      printf("%s was not built for this executable, using the original files\n", fname);
+      PK_Shutdown();
+      return false;
+   }
+
+   if (!PK_Current())
+   {
+      printf("%s was built from other game files, using the original files\n", fname);
+      PK_Shutdown();
+      return false;
+   }
+
+   return true;
+}
+
+void PK_Shutdown (void)
+{
+   if (!pack)
+      return;
+
+   if (packmapped)
+   {
+#ifdef _WIN32
+      UnmapViewOfFile(pack);
+#elif defined(PK_CAN_MAP)
+      munmap(pack, packsize);
+#endif
+   }
+   else if (!packmounted)
+      free(pack);
+
+   pack        = NULL;
+   packsize    = 0;
+   packmapped  = false;
+   packmounted = false;
+}
+
+/*
+===================
+=
+= PK_Write
+=
+= Appends size bytes of data to the pack being built, PACKALIGN aligned,
+= and returns where they went
+=
+===================
+*/
+
+packentry PK_Write (FILE *file, const void *data, uint32_t size)
+{
+   static const byte zeros[PACKALIGN];
+   packentry entry;
+   long      pos = ftell(file);
+
+   if (pos % PACKALIGN)
+   {
+      fwrite(zeros, 1, PACKALIGN - pos % PACKALIGN, file);
+      pos += PACKALIGN - pos % PACKALIGN;
+   }
+
+   entry.offset = (uint32_t) pos;
+   entry.size   = size;
+   if (size)
+      fwrite(data, 1, size, file);
+
+   return entry;
+}
+
+/*
+===================
+=
+= PK_BuildPack
+=
+= Writes pack.ext from what PM_Startup and CA_Startup loaded from the
+= original files
+=
+===================
+*/
+
+void PK_BuildPack (void)
+{
+   char       fname[13], tmpname[20];
+   packheader head;
+   FILE      *file;
+   long       size;
+   int        i;
+
+   PK_FileName(fname);
+   snprintf(tmpname, sizeof(tmpname), "%s.tmp", fname);
+
+   file = fopen(tmpname, "wb");
+   if (!file)
+      Quit("Unable to create %s!", tmpname);
+
+   /* written again once the entries are known */
+   memset(&head, 0, sizeof(head));
+   fwrite(&head, sizeof(head), 1, file);
+
+   PM_WritePack(file, &head);
+   CA_WritePack(file, &head);
+
+   head.magic   = PACKMAGIC;
+   head.version = PACKVERSION;
+   for (i = 0; i < PACKSOURCES; i++)
+      PK_SourceInfo(i, &head.sources[i]);
+
+   size = ftell(file);
+   fseek(file, 0, SEEK_SET);
+   fwrite(&head, sizeof(head), 1, file);
+
+   if (ferror(file) | fclose(file))
+      Quit("Unable to write %s!", tmpname);
+
+   remove(fname);
+   if (rename(tmpname, fname))
+      Quit("Unable to rename %s to %s!", tmpname, fname);
+
+   printf("Wrote %s (%ld KB)\n", fname, (size + 1023) / 1024);
+}
@@ -0,0 +1,60 @@
+#ifndef __ID_PK__
+#define __ID_PK__
+
+#include "boolean.h"
+
+// The asset pack holds the page file, the expanded graphics chunks, the
+// expanded maps and the converted audio chunks of one game in native byte
+// order.  --buildpack writes it from the original files, and while it
+// exists the engine maps it and only copies out of it.
+
+#define PACKMAGIC   0x4b504c57      // "WLPK" when written little endian
+#define PACKVERSION 2
+#define PACKALIGN   16
+#define PACKSOURCES 8               // original files the pack is checked against
+
+typedef struct
+{
+    uint32_t offset, size;          // from the start of the pack, size 0 if sparse
+} packentry;
+
+typedef struct
+{
+    int64_t size, mtime;            // size -1 if missing, mtime 0 if mounted
+} packsource;
+
+typedef struct
+{
+    uint32_t  magic;                // PACKMAGIC, also tells the byte order
+    uint32_t  version;
+    uint32_t  numpages, spritestart, soundstart, soundinfopadded;
+    uint32_t  numchunks, numpics, nummaps, numsndchunks;
+    packentry pages;                // the pages back to back, laid out like PM_ReadPages does
+    packentry pagestarts;           // numpages+1 offsets into pages
+    packentry pictable;             // numpics pictabletype
+    packentry chunks;               // numchunks packentrys of expanded graphics chunks
+    packentry maps;                 // nummaps packentrys of a maptype followed by the planes
+    packentry sounds;               // numsndchunks packentrys, AdLib sounds as AdLibSound
+    packsource sources[PACKSOURCES]; // the original files when the pack was built
+} packheader;
+
+// The mapped pack, NULL while the original files are used
+extern packheader *pack;
+
+boolean PK_Startup(void);
+void PK_Shutdown(void);
+packentry PK_Write(FILE *file, const void *data, uint32_t size);
+void PK_BuildPack(void);
+
+static inline const void *PK_Data(packentry entry)
+{
+    return (const uint8_t *) pack + entry.offset;
+}
+
+// Entry i of a table of packentrys
+static inline packentry PK_Entry(packentry table, int i)
+{
+    return ((const packentry *) PK_Data(table))[i];
+}
+
+#endif
@@ -1,5 +1,18 @@
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#define PM_CAN_MAP
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define PM_CAN_MAP
+#endif
+
 #include "wl_def.h"
 #include <retro_endian.h>
+#ifdef HAVE_THREADS
+#include <rthreads/rthreads.h>
+#endif
 
 int ChunksInFile;
 int PMSpriteStart;
@@ -7,49 +20,597 @@ int PMSoundStart;
 
 bool PMSoundInfoPagePadded = false;
 
-/* holds the whole VSWAP */
+/* holds the whole VSWAP when it is read instead of mapped */
 uint32_t *PMPageData;
 size_t PMPageDataSize;
 
+/* the mapped VSWAP and the copies of its pages that are not 2-byte aligned,
+ * PMMapping stays NULL when the pages point into a mounted VSWAP */
+static uint8_t *PMMapping;
+static size_t   PMMappingSize;
+static uint8_t *PMAlignedPages;
+
 /*
  * ChunksInFile+1 pointers to page starts.
  * The last pointer points one byte after the last page.
  */
 uint8_t **PMPages;
 
+/*
+ * Page sizes as if all pages were stored back to back with the
+ * alignment padding, padding counts towards the page before it.
+ */
+uint32_t *PMPageSizes;
+
+spriteruns_t **PMSpriteRuns;
+
+/*
+ * The page cache.  Loaded pages form a list in the order they were last
+ * used, most recent first, and are evicted from its tail once the budget
+ * is exceeded.  A page stays pinned until PM_UnpinPages is called, so the
+ * pointers handed out for a frame stay valid until the next one starts.
+ * Render threads fetch textures concurrently, so all of it is locked.
+ * The decoded sprites are entries of their own after the pages, entry
+ * ChunksInFile + shapenum, and share the list and the budget with them.
+ */
+typedef struct
+{
+   uint8_t *data;               // NULL while the page is not loaded
+   uint32_t size;               // bytes loaded, may reach into the next pages
+   uint32_t pinframe;           // PMCacheFrame when the page was last used
+   int      prev, next;         // neighbours in the list, -1 at its ends
+} pmcachepage_t;
+
+boolean        PMCaching;
+pmcachestats_t PMCacheStats;
+
+static pmcachepage_t *PMCache;
+static int            PMCacheHead = -1, PMCacheTail = -1;
+static uint32_t       PMCacheFrame;
+static size_t         PMCacheBudget;
+static vfile         *PMCacheFile;
+static uint32_t      *PMCacheOffsets;    // file offsets, ChunksInFile+1 of them
+#ifdef HAVE_THREADS
+static slock_t       *PMCacheLock;
+#endif
+
+/*
+ * Sprite pages and the sound info page are accessed as words.
+ */
+static boolean PM_NeedsAlignment(int page)
+{
+   return (page >= PMSpriteStart && page < PMSoundStart) || page == ChunksInFile - 1;
+}
+
+static uint32_t PM_FilePageSize(int page, uint32_t *pageOffsets, word *pageLengths)
+{
+   /* Use specified page length,
+    * when next page is sparse page.
+    * Otherwise, calculate size from
+    * the offset difference between this and the next page. */
+   if(!pageOffsets[page + 1])
+      return pageLengths[page];
+   return pageOffsets[page + 1] - pageOffsets[page];
+}
+
+/*
+ * Reads every page into one buffer, 2-byte aligning the pages that need it.
+ * pageStarts receives where each page starts in that buffer.
+ */
+static void PM_ReadPages(vfile *file, uint32_t *pageOffsets, word *pageLengths,
+      uint32_t *pageStarts, size_t dataSize)
+{
+   int i;
+   uint8_t *ptr;
+
+   PMPageDataSize = dataSize;
+   PMPageData = (uint32_t *) malloc(PMPageDataSize);
+   CHECKMALLOCRESULT(PMPageData);
+
+   /* Load pages and initialize PMPages pointers */
+   ptr = (uint8_t *) PMPageData;
+
+   for(i = 0; i < ChunksInFile; i++)
+   {
+      uint32_t size;
+
+      if(PM_NeedsAlignment(i))
+      {
+         size_t offs = ptr - (uint8_t *) PMPageData;
+
+         /* pad with zeros to make it 2-byte aligned */
+
+         if(offs & 1)
+         {
+            *ptr++ = 0;
+            if(i == ChunksInFile - 1) PMSoundInfoPagePadded = true;
+         }
+      }
+
+      PMPages[i] = ptr;
+      pageStarts[i] = (uint32_t) (ptr - (uint8_t *) PMPageData);
+
+      if(!pageOffsets[i])
+         continue;               // sparse page
+
+      size = PM_FilePageSize(i, pageOffsets, pageLengths);
+
+      VF_Seek(file, pageOffsets[i]);
+      VF_Read(file, ptr, size);
+      ptr += size;
+   }
+
+   /* last page points after page buffer */
+   PMPages[ChunksInFile] = ptr;
+   pageStarts[ChunksInFile] = (uint32_t) (ptr - (uint8_t *) PMPageData);
+}
+
+/*
+ * Computes where each page would start in PM_ReadPages's buffer, so pages
+ * that are not read into it still get the same sizes.
+ */
+static void PM_LayoutPages(uint32_t *pageOffsets, word *pageLengths, uint32_t *pageStarts)
+{
+   int i;
+   uint32_t start = 0;
+
+   for(i = 0; i < ChunksInFile; i++)
+   {
+      if(PM_NeedsAlignment(i) && (start & 1))
+      {
+         start++;
+         if(i == ChunksInFile - 1) PMSoundInfoPagePadded = true;
+      }
+
+      pageStarts[i] = start;
+      if(pageOffsets[i])
+         start += PM_FilePageSize(i, pageOffsets, pageLengths);
+   }
+   pageStarts[ChunksInFile] = start;
+}
+
+#ifdef PM_CAN_MAP
+/*
+ * Maps the file read-only, so pages are only read when they are used and
+ * are shared with other processes.
+ */
+static uint8_t *PM_MapFile(FILE *file, long fileSize)
+{
+   uint8_t *base;
+
+#ifdef _WIN32
+   HANDLE mapping = CreateFileMapping((HANDLE) _get_osfhandle(_fileno(file)),
+         NULL, PAGE_READONLY, 0, 0, NULL);
+   if(!mapping)
+      return NULL;
+   base = (uint8_t *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+   CloseHandle(mapping);        // the view keeps the mapping alive
+   if(!base)
+      return NULL;
+#else
+   base = (uint8_t *) mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fileno(file), 0);
+   if(base == (uint8_t *) MAP_FAILED)
+      return NULL;
+#endif
+
+   PMMapping     = base;
+   PMMappingSize = fileSize;
+   return base;
+}
+#endif
+
+/*
+ * Points the pages into base, the whole file mapped or mounted in memory.
+ * Pages that need alignment but sit at odd addresses are copied to
+ * PMAlignedPages.  pageStarts receives where each page would start in
+ * PM_ReadPages's buffer.
+ */
+static void PM_PointPages(uint8_t *base, long fileSize, uint32_t *pageOffsets,
+      word *pageLengths, uint32_t *pageStarts)
+{
+   int i;
+   size_t aligned = 0, alignedSize = 0;
+
+   PM_LayoutPages(pageOffsets, pageLengths, pageStarts);
+
+   for(i = 0; i < ChunksInFile; i++)
+   {
+      if(pageOffsets[i] && PM_NeedsAlignment(i) && ((uintptr_t) (base + pageOffsets[i]) & 1))
+         alignedSize += (pageStarts[i + 1] - pageStarts[i] + 1) & ~1;
+   }
+
+   if(alignedSize)
+   {
+      PMAlignedPages = (uint8_t *) calloc(alignedSize, 1);
+      CHECKMALLOCRESULT(PMAlignedPages);
+   }
+
+   for(i = 0; i < ChunksInFile; i++)
+   {
+      PMPages[i] = base + pageOffsets[i];
+
+      if(pageOffsets[i] && PM_NeedsAlignment(i) && ((uintptr_t) PMPages[i] & 1))
+      {
+         memcpy(PMAlignedPages + aligned, PMPages[i], PM_FilePageSize(i, pageOffsets, pageLengths));
+         PMPages[i] = PMAlignedPages + aligned;
+         aligned += (pageStarts[i + 1] - pageStarts[i] + 1) & ~1;
+      }
+   }
+
+   /* last page points after the file */
+   PMPages[ChunksInFile] = base + fileSize;
+}
+
+/*
+ * Keeps the file open and loads pages from it on demand, see PM_CachePages.
+ */
+static void PM_StartCache(vfile *file, uint32_t *pageOffsets, word *pageLengths,
+      uint32_t *pageStarts)
+{
+   int i;
+
+   PM_LayoutPages(pageOffsets, pageLengths, pageStarts);
+
+   free(PMPages);
+   PMPages = NULL;
+
+   PMCache = (pmcachepage_t *) malloc((ChunksInFile + PMSoundStart - PMSpriteStart) * sizeof(*PMCache));
+   CHECKMALLOCRESULT(PMCache);
+   for(i = 0; i < ChunksInFile + PMSoundStart - PMSpriteStart; i++)
+   {
+      PMCache[i].data     = NULL;
+      PMCache[i].size     = 0;
+      PMCache[i].pinframe = 0;
+      PMCache[i].prev     = -1;
+      PMCache[i].next     = -1;
+   }
+
+#ifdef HAVE_THREADS
+   PMCacheLock = slock_new();
+   if(!PMCacheLock)
+      Quit("PM_Startup: Unable to create the page cache lock");
+#endif
+
+   PMCacheHead    = -1;
+   PMCacheTail    = -1;
+   PMCacheFrame   = 1;
+   PMCacheBudget  = (size_t) param_pagecache * 1024;
+   PMCacheFile    = file;
+   PMCacheOffsets = pageOffsets;
+   memset(&PMCacheStats, 0, sizeof(PMCacheStats));
+   PMCaching      = true;
+}
+
+static void PM_LockCache(void)
+{
+#ifdef HAVE_THREADS
+   slock_lock(PMCacheLock);
+#endif
+}
+
+static void PM_UnlockCache(void)
+{
+#ifdef HAVE_THREADS
+   slock_unlock(PMCacheLock);
+#endif
+}
+
+static void PM_CacheUnlink(int page)
+{
+   pmcachepage_t *cp = &PMCache[page];
+
+   if(cp->prev != -1) PMCache[cp->prev].next = cp->next;
+   else PMCacheHead = cp->next;
+   if(cp->next != -1) PMCache[cp->next].prev = cp->prev;
+   else PMCacheTail = cp->prev;
+   cp->prev = cp->next = -1;
+}
+
+static void PM_CacheLinkHead(int page)
+{
+   pmcachepage_t *cp = &PMCache[page];
+
+   cp->prev = -1;
+   cp->next = PMCacheHead;
+   if(PMCacheHead != -1) PMCache[PMCacheHead].prev = page;
+   else PMCacheTail = page;
+   PMCacheHead = page;
+}
+
+static void PM_CacheAdd(int page, uint8_t *data, uint32_t size)
+{
+   PMCache[page].data = data;
+   PMCache[page].size = size;
+
+   PMCacheStats.bytes += size;
+   if(PMCacheStats.bytes > PMCacheStats.peakbytes)
+      PMCacheStats.peakbytes = PMCacheStats.bytes;
+}
+
+static void PM_CacheDrop(int page)
+{
+   PM_CacheUnlink(page);
+   PMCacheStats.bytes -= PMCache[page].size;
+   free(PMCache[page].data);
+   PMCache[page].data = NULL;
+   PMCache[page].size = 0;
+}
+
+/*
+ * Evicts the least recently used pages until needed more bytes fit into
+ * the budget.  Pages used since the last PM_UnpinPages are all at the head
+ * of the list, so the first pinned one ends the search and the cache grows
+ * over budget for that frame instead.
+ */
+static void PM_CacheEvict(uint32_t needed)
+{
+   while(PMCacheTail != -1 && PMCacheStats.bytes + needed > PMCacheBudget)
+   {
+      if(PMCache[PMCacheTail].pinframe == PMCacheFrame)
+         break;
+
+      PM_CacheDrop(PMCacheTail);
+      PMCacheStats.evictions++;
+   }
+}
+
+/*
+ * Reads size bytes from the start of page into a new buffer.  The sizes
+ * include alignment padding that is not in the file, and sparse pages are
+ * not in it at all, so whatever the file doesn't have reads as zeros.
+ * Returns NULL if memory or the read fails, the caller holds the lock and
+ * has to release it before it quits.
+ */
+static uint8_t *PM_CacheLoad(int page, uint32_t size)
+{
+   uint32_t offset = PMCacheOffsets[page];
+   uint32_t avail  = 0;
+   uint8_t *data   = (uint8_t *) malloc(size ? size : 1);
+
+   if(!data)
+      return NULL;
+
+   if(offset)
+   {
+      avail = PMCacheOffsets[ChunksInFile] - offset;
+      if(avail > size)
+         avail = size;
+
+      VF_Seek(PMCacheFile, offset);
+      if(VF_Read(PMCacheFile, data, avail) != (long) avail)
+      {
+         free(data);
+         return NULL;
+      }
+   }
+   memset(data + avail, 0, size - avail);
+
+   return data;
+}
+
+/*
+ * Returns at least size bytes starting at page, loading them if needed,
+ * and pins them until the next PM_UnpinPages.
+ */
+uint8_t *PM_CachePages(int page, uint32_t size)
+{
+   pmcachepage_t *cp = &PMCache[page];
+   uint8_t *data;
+
+   PM_LockCache();
+
+   if(cp->data && cp->size >= size)
+   {
+      PMCacheStats.hits++;
+      PM_CacheUnlink(page);
+   }
+   else
+   {
+      /* every caller asks for a page at one size, so growing only
+       * happens to pages that were not handed out this frame */
+      if(cp->data)
+         PM_CacheDrop(page);
+
+      PMCacheStats.misses++;
+      PM_CacheEvict(size);
+
+      LR_TRACE_BEGIN("PM_CachePages");
+      data = PM_CacheLoad(page, size);
+      LR_TRACE_END("PM_CachePages");
+
+      /* a Quit caught on another thread must not leave the cache locked */
+      if(!data)
+      {
+         PM_UnlockCache();
+         Quit("PM_CachePages: Unable to load page %i!", page);
+      }
+      PM_CacheAdd(page, data, size);
+   }
+
+   cp->pinframe = PMCacheFrame;
+   PM_CacheLinkHead(page);
+   data = cp->data;
+
+   PM_UnlockCache();
+
+   return data;
+}
+
+static spriteruns_t *PM_DecodeShape(int shapenum, byte *shape, uint32_t *size);
+
+/*
+ * Returns sprite shapenum decoded, decoding it from its page if needed, and
+ * pins it until the next PM_UnpinPages.  The page is read into a buffer of
+ * its own for that and not cached, only the decoded sprite is.
+ */
+spriteruns_t *PM_CacheSpriteRuns(int shapenum)
+{
+   int entry          = ChunksInFile + shapenum;
+   int page           = PMSpriteStart + shapenum;
+   pmcachepage_t *cp  = &PMCache[entry];
+   spriteruns_t *sprite;
+   uint8_t *shape;
+   uint32_t size;
+
+   PM_LockCache();
+
+   if(cp->data)
+   {
+      PMCacheStats.hits++;
+      PM_CacheUnlink(entry);
+   }
+   else
+   {
+      PMCacheStats.misses++;
+
+      LR_TRACE_BEGIN("PM_CacheSpriteRuns");
+      shape = PM_CacheLoad(page, PMPageSizes[page]);
+      PM_UnlockCache();
+      if(!shape)
+         Quit("PM_CacheSpriteRuns: Unable to load sprite %i!", shapenum);
+
+      /* decoding can quit as well, so it runs unlocked */
+      sprite = PM_DecodeShape(shapenum, shape, &size);
+      free(shape);
+      LR_TRACE_END("PM_CacheSpriteRuns");
+
+      PM_LockCache();
+      if(cp->data)
+      {
+         /* decoded by another thread meanwhile */
+         free(sprite);
+         PM_CacheUnlink(entry);
+      }
+      else
+      {
+         PM_CacheEvict(size);
+         PM_CacheAdd(entry, (uint8_t *) sprite, size);
+      }
+   }
+
+   cp->pinframe = PMCacheFrame;
+   PM_CacheLinkHead(entry);
+   sprite = (spriteruns_t *) cp->data;
+
+   PM_UnlockCache();
+
+   return sprite;
+}
+
+/*
+ * Lets the pages handed out so far be evicted again.  The renderer calls
+ * this at the start of every frame, loaders once they copied what they need.
+ * No other thread may be using pages while it runs.
+ */
+void PM_UnpinPages(void)
+{
+   PMCacheFrame++;
+}
+
+/*
+ * Points the pages into the pack, which has them laid out like
+ * PM_ReadPages does.
+ */
+static void PM_UsePack(void)
+{
+   int i;
+   const uint32_t *pageStarts = (const uint32_t *) PK_Data(pack->pagestarts);
+   uint8_t *base              = (uint8_t *) PK_Data(pack->pages);
+
+   ChunksInFile          = pack->numpages;
+   PMSpriteStart         = pack->spritestart;
+   PMSoundStart          = pack->soundstart;
+   PMSoundInfoPagePadded = pack->soundinfopadded != 0;
+
+   PMPages = (uint8_t **) malloc((ChunksInFile + 1) * sizeof(uint8_t *));
+   CHECKMALLOCRESULT(PMPages);
+   PMPageSizes = (uint32_t *) malloc(ChunksInFile * sizeof(uint32_t));
+   CHECKMALLOCRESULT(PMPageSizes);
+
+   for(i = 0; i < ChunksInFile; i++)
+   {
+      if(pageStarts[i] > pageStarts[i + 1] || pageStarts[i + 1] > pack->pages.size)
+         Quit("PM_Startup: Illegal pack offset for page %i: %u", i, pageStarts[i]);
+
+      PMPages[i]     = base + pageStarts[i];
+      PMPageSizes[i] = pageStarts[i + 1] - pageStarts[i];
+   }
+   PMPages[ChunksInFile] = base + pageStarts[ChunksInFile];
+
+   PMSpriteRuns = (spriteruns_t **) calloc(PMSoundStart - PMSpriteStart, sizeof(*PMSpriteRuns));
+   CHECKMALLOCRESULT(PMSpriteRuns);
+}
+
+/*
+ * Writes the pages to the pack being built, back to back like
+ * PM_ReadPages lays them out.  The pages entry starts aligned, so the
+ * pages that need it stay 2-byte aligned.
+ */
+void PM_WritePack(FILE *file, packheader *head)
+{
+   int i;
+   uint32_t *pageStarts = (uint32_t *) malloc((ChunksInFile + 1) * sizeof(uint32_t));
+   CHECKMALLOCRESULT(pageStarts);
+
+   head->numpages        = ChunksInFile;
+   head->spritestart     = PMSpriteStart;
+   head->soundstart      = PMSoundStart;
+   head->soundinfopadded = PMSoundInfoPagePadded;
+
+   head->pages = PK_Write(file, PM_GetPage(0), PMPageSizes[0]);
+   pageStarts[0] = 0;
+   for(i = 1; i <= ChunksInFile; i++)
+   {
+      pageStarts[i] = pageStarts[i - 1] + PMPageSizes[i - 1];
+      if(i < ChunksInFile)
+         fwrite(PM_GetPage(i), 1, PMPageSizes[i], file);
+      PM_UnpinPages();
+   }
+   head->pages.size = pageStarts[ChunksInFile];
+
+   head->pagestarts = PK_Write(file, pageStarts, (ChunksInFile + 1) * sizeof(uint32_t));
+   free(pageStarts);
+}
+
 void PM_Startup(void)
 {
    int i, j, k;
    long fileSize, pageDataSize;
-   FILE *file;
+   vfile *file;
    uint32_t *pageOffsets;
+   uint32_t *pageStarts;
    uint32_t dataStart;
    word *pageLengths;
-   uint8_t *ptr;
    int alignPadding = 0;
    char fname[13] = "vswap.";
 
+   if(pack)
+   {
+      PM_UsePack();
+      return;
+   }
+
    strcat(fname,extension);
 
-   file = fopen(fname,"rb");
+   file = VF_Open(fname);
    if(!file)
       CA_CannotOpen(fname);
 
    ChunksInFile = 0;
-   fread(&ChunksInFile, sizeof(word), 1, file);
+   VF_Read(file, &ChunksInFile, sizeof(word));
    ChunksInFile = Retro_SwapLES32(ChunksInFile);
 
    PMSpriteStart = 0;
-   fread(&PMSpriteStart, sizeof(word), 1, file);
+   VF_Read(file, &PMSpriteStart, sizeof(word));
    PMSpriteStart = Retro_SwapLES32(PMSpriteStart);
 
    PMSoundStart = 0;
-   fread(&PMSoundStart, sizeof(word), 1, file);
+   VF_Read(file, &PMSoundStart, sizeof(word));
    PMSoundStart = Retro_SwapLES32(PMSoundStart);
 
    pageOffsets = (uint32_t *) malloc((ChunksInFile + 1) * sizeof(int32_t));
    CHECKMALLOCRESULT(pageOffsets);
-   fread(pageOffsets, sizeof(uint32_t), ChunksInFile, file);
+   VF_Read(file, pageOffsets, ChunksInFile * sizeof(uint32_t));
 
    for (k = 0; k < ChunksInFile; k++)
    {
@@ -58,15 +619,14 @@ void PM_Startup(void)
 
    pageLengths = (word *) malloc(ChunksInFile * sizeof(word));
    CHECKMALLOCRESULT(pageLengths);
-   fread(pageLengths, sizeof(word), ChunksInFile, file);
+   VF_Read(file, pageLengths, ChunksInFile * sizeof(word));
 
 	for(j = 0; j < ChunksInFile; j++)
 	{
 		pageLengths[j] = (word)Retro_SwapLES16(pageLengths[j]);
 	}
 
-   fseek(file, 0, SEEK_END);
-   fileSize = ftell(file);
+   fileSize = VF_Size(file);
    pageDataSize = fileSize - pageOffsets[0];
 
    if(pageDataSize > (size_t) -1)
@@ -103,60 +663,176 @@ void PM_Startup(void)
    if((pageOffsets[ChunksInFile - 1] - dataStart + alignPadding) & 1)
       alignPadding++;
 
-   PMPageDataSize = (size_t) pageDataSize + alignPadding;
-   PMPageData = (uint32_t *) malloc(PMPageDataSize);
-   CHECKMALLOCRESULT(PMPageData);
-
    PMPages = (uint8_t **) malloc((ChunksInFile + 1) * sizeof(uint8_t *));
    CHECKMALLOCRESULT(PMPages);
 
-   /* Load pages and initialize PMPages pointers */
-   ptr = (uint8_t *) PMPageData;
-
+   pageStarts = (uint32_t *) malloc((ChunksInFile + 1) * sizeof(uint32_t));
+   CHECKMALLOCRESULT(pageStarts);
+
+   PMSoundInfoPagePadded = false;
+   if(param_pagecache)
+      PM_StartCache(file, pageOffsets, pageLengths, pageStarts);
+   else if(VF_Memory(file))
+      PM_PointPages((uint8_t *) VF_Memory(file), fileSize, pageOffsets, pageLengths, pageStarts);
+#ifdef PM_CAN_MAP
+   else if(param_mmapvswap && PM_MapFile(VF_Stream(file), fileSize))
+      PM_PointPages(PMMapping, fileSize, pageOffsets, pageLengths, pageStarts);
+#endif
+   else
+      PM_ReadPages(file, pageOffsets, pageLengths, pageStarts, (size_t) pageDataSize + alignPadding);
+
+   PMPageSizes = (uint32_t *) malloc(ChunksInFile * sizeof(uint32_t));
+   CHECKMALLOCRESULT(PMPageSizes);
    for(i = 0; i < ChunksInFile; i++)
+      PMPageSizes[i] = pageStarts[i + 1] - pageStarts[i];
+
+   free(pageStarts);
+   free(pageLengths);
+
+   /* the page cache keeps reading from the file */
+   if(!PMCaching)
    {
-      uint32_t size;
+      free(pageOffsets);
+      VF_Close(file);
+   }
 
-      if(((i >= PMSpriteStart) && (i < PMSoundStart)) || (i == ChunksInFile - 1))
+   /* the page cache keeps the decoded sprites itself */
+   if(!PMCaching)
+   {
+      PMSpriteRuns = (spriteruns_t **) calloc(PMSoundStart - PMSpriteStart, sizeof(*PMSpriteRuns));
+      CHECKMALLOCRESULT(PMSpriteRuns);
+   }
+}
+
+void PM_Shutdown(void)
+{
+   int i;
+
+   if(PMSpriteRuns)
+   {
+      for(i = 0; i < PMSoundStart - PMSpriteStart; i++)
+         free(PMSpriteRuns[i]);
+      free(PMSpriteRuns);
+      PMSpriteRuns = NULL;
+   }
+
+   if(PMCaching)
+   {
+      printf("Page cache: %u hits, %u misses, %u evictions, %u of %u KB used at most\n",
+            PMCacheStats.hits, PMCacheStats.misses, PMCacheStats.evictions,
+            (unsigned) ((PMCacheStats.peakbytes + 1023) / 1024), (unsigned) param_pagecache);
+
+      while(PMCacheHead != -1)
+         PM_CacheDrop(PMCacheHead);
+      free(PMCache);
+      free(PMCacheOffsets);
+      VF_Close(PMCacheFile);
+#ifdef HAVE_THREADS
+      slock_free(PMCacheLock);
+      PMCacheLock = NULL;
+#endif
+      PMCache        = NULL;
+      PMCacheOffsets = NULL;
+      PMCacheFile    = NULL;
+      PMCaching      = false;
+   }
+
+   free(PMPageSizes);
+   free(PMPages);
+   free(PMPageData);
+   free(PMAlignedPages);
+   PMPageSizes    = NULL;
+   PMPages        = NULL;
+   PMPageData     = NULL;
+   PMAlignedPages = NULL;
+
+   if(PMMapping)
+   {
+#ifdef _WIN32
+      UnmapViewOfFile(PMMapping);
+#elif defined(PM_CAN_MAP)
+      munmap(PMMapping, PMMappingSize);
+#endif
+      PMMapping = NULL;
+   }
+}
+
+/*
+ * Converts the little endian post commands of a t_compshape into
+ * runs, so the scalers don't have to parse and swap them every frame.
+ * The first pass only counts what the second one stores.  size receives
+ * the bytes of the single block the sprite is allocated in.
+ */
+static spriteruns_t *PM_DecodeShape(int shapenum, byte *shape, uint32_t *size)
+{
+   int pass, i, numruns = 0, numtexels = 0;
+   spriteruns_t *sprite = NULL;
+   word leftpix         = (word)Retro_SwapLES16(((t_compshape *) shape)->leftpix);
+   word rightpix        = (word)Retro_SwapLES16(((t_compshape *) shape)->rightpix);
+   int numcolumns       = rightpix - leftpix + 1;
+
+   if(numcolumns < 0)
+      numcolumns = 0;
+   if(numcolumns > 64)
+      Quit("PM_DecodeShape: Sprite %i is too wide", shapenum);
+
+   for(pass = 0; pass < 2; pass++)
+   {
+      int run = 0, texel = 0;
+
+      for(i = 0; i < numcolumns; i++)
       {
-         size_t offs = ptr - (uint8_t *) PMPageData;
+         word endy;
+         byte *line = shape + (word)Retro_SwapLES16(((t_compshape *) shape)->dataofs[i]);
 
-         /* pad with zeros to make it 2-byte aligned */
+         if(sprite)
+            sprite->firstrun[i] = run;
 
-         if(offs & 1)
+         while((endy = READWORD(&line)) != 0)
          {
-            *ptr++ = 0;
-            if(i == ChunksInFile - 1) PMSoundInfoPagePadded = true;
+            short newstart = READWORD(&line);
+            word starty    = READWORD(&line) >> 1;
+
+            endy >>= 1;
+            if(starty >= endy)
+               continue;
+
+            if(sprite)
+            {
+               sprite->runs[run].starty = starty;
+               sprite->runs[run].endy   = endy;
+               sprite->runs[run].pixels = texel;
+               memcpy(sprite->texels + texel, shape + newstart + starty, endy - starty);
+            }
+            run++;
+            texel += endy - starty;
          }
       }
 
-      PMPages[i] = ptr;
-
-      if(!pageOffsets[i])
-         continue;               // sparse page
+      if(sprite)
+      {
+         sprite->firstrun[numcolumns] = run;
+         break;
+      }
 
-      /* Use specified page length, 
-       * when next page is sparse page.
-       * Otherwise, calculate size from 
-       * the offset difference between this and the next page. */
-      if(!pageOffsets[i + 1]) size = pageLengths[i];
-      else size = pageOffsets[i + 1] - pageOffsets[i];
+      numruns   = run;
+      numtexels = texel;
 
-      fseek(file, pageOffsets[i], SEEK_SET);
-      fread(ptr, 1, size, file);
-      ptr += size;
+      *size  = sizeof(*sprite) + numruns * sizeof(spriterun_t) + numtexels;
+      sprite = (spriteruns_t *) malloc(*size);
+      CHECKMALLOCRESULT(sprite);
+      sprite->leftpix  = leftpix;
+      sprite->rightpix = rightpix;
+      sprite->runs     = (spriterun_t *) (sprite + 1);
+      sprite->texels   = (byte *) (sprite->runs + numruns);
    }
 
-   /* last page points after page buffer */
-   PMPages[ChunksInFile] = ptr;
-
-   free(pageLengths);
-   free(pageOffsets);
-   fclose(file);
+   return sprite;
 }
 
-void PM_Shutdown(void)
+spriteruns_t *PM_DecodeSprite(int shapenum)
 {
-   free(PMPages);
-   free(PMPageData);
+   uint32_t size;
+
+   return PM_DecodeShape(shapenum, (byte *) PM_GetSprite(shapenum), &size);
 }
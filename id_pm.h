@@ -15,26 +15,80 @@ extern bool PMSoundInfoPagePadded;
 // The last pointer points one byte after the last page.
 extern uint8_t **PMPages;
 
+// Page sizes, including the alignment padding that follows a page
+extern uint32_t *PMPageSizes;
+
+// With --pagecache, pages are loaded on first use and the least recently
+// used ones are dropped again to stay within the budget.  PMPages is then
+// NULL and the pages are only reachable through PM_GetPage/PM_GetPages.
+// Decoded sprites are kept in the same cache and count towards the budget.
+extern boolean PMCaching;
+
+typedef struct
+{
+    uint32_t hits, misses, evictions;
+    size_t   bytes, peakbytes;
+} pmcachestats_t;
+
+extern pmcachestats_t PMCacheStats;
+
+// A sprite decoded into native endian opaque runs.
+// The runs of column x are runs[firstrun[x - leftpix]] up to
+// runs[firstrun[x - leftpix + 1]], texel j of a run is
+// texels[pixels + j - starty].
+typedef struct
+{
+    uint16_t starty, endy;
+    uint16_t pixels;
+} spriterun_t;
+
+typedef struct
+{
+    uint16_t leftpix, rightpix;
+    uint16_t firstrun[65];
+    spriterun_t *runs;
+    uint8_t *texels;
+} spriteruns_t;
+
+// Decoded sprites, built on first use by PM_GetSpriteRuns and kept until
+// PM_Shutdown.  Not used with --pagecache.
+extern spriteruns_t **PMSpriteRuns;
+
 void PM_Startup(void);
 void PM_Shutdown(void);
+void PM_WritePack(FILE *file, packheader *head);
+uint8_t *PM_CachePages(int page, uint32_t size);
+void PM_UnpinPages(void);
+spriteruns_t *PM_DecodeSprite(int shapenum);
+spriteruns_t *PM_CacheSpriteRuns(int shapenum);
 
 static inline uint32_t PM_GetPageSize(int page)
 {
     if(page < 0 || page >= ChunksInFile)
         Quit("PM_GetPageSize: Tried to access illegal page: %i", page);
-    return (uint32_t) (PMPages[page + 1] - PMPages[page]);
+    return PMPageSizes[page];
 }
 
 static inline uint8_t *PM_GetPage(int page)
 {
     if(page < 0 || page >= ChunksInFile)
         Quit("PM_GetPage: Tried to access illegal page: %i", page);
+    if(PMCaching)
+        return PM_CachePages(page, PMPageSizes[page]);
     return PMPages[page];
 }
 
-static inline uint8_t *PM_GetEnd(void)
+// Returns size contiguous bytes starting at page, for data like
+// digitized sounds that spans several pages
+static inline uint8_t *PM_GetPages(int page, uint32_t size)
 {
-    return PMPages[ChunksInFile];
+    if(page < 0 || page >= ChunksInFile)
+        Quit("PM_GetPages: Tried to access illegal page: %i", page);
+    if(PMCaching)
+        return PM_CachePages(page, size);
+    if(size > (size_t) (PMPages[ChunksInFile] - PMPages[page]))
+        Quit("PM_GetPages: %u bytes from page %i reach out of the page file", size, page);
+    return PMPages[page];
 }
 
 static inline byte *PM_GetTexture(int wallpic)
@@ -48,6 +102,17 @@ static inline uint16_t *PM_GetSprite(int shapenum)
     return (uint16_t *) (void *) PM_GetPage(PMSpriteStart + shapenum);
 }
 
+static inline spriteruns_t *PM_GetSpriteRuns(int shapenum)
+{
+    if(shapenum < 0 || shapenum >= PMSoundStart - PMSpriteStart)
+        Quit("PM_GetSpriteRuns: Tried to access illegal sprite: %i", shapenum);
+    if(PMCaching)
+        return PM_CacheSpriteRuns(shapenum);
+    if(!PMSpriteRuns[shapenum])
+        PMSpriteRuns[shapenum] = PM_DecodeSprite(shapenum);
+    return PMSpriteRuns[shapenum];
+}
+
 static inline byte *PM_GetSound(int soundpagenum)
 {
     return PM_GetPage(PMSoundStart + soundpagenum);
@@ -34,35 +34,25 @@
 
 #define ORIGSAMPLERATE 7042
 
-typedef struct
-{
-    char RIFF[4];
-    longword filelenminus8;
-    char WAVE[4];
-    char fmt_[4];
-    longword formatlen;
-    word val0x0001;
-    word channels;
-    longword samplerate;
-    longword bytespersec;
-    word bytespersample;
-    word bitspersample;
-} headchunk;
-
-typedef struct
-{
-    char chunkid[4];
-    longword chunklength;
-} wavechunk;
-
 typedef struct
 {
     uint32_t startpage;
     uint32_t length;
 } digiinfo;
 
+/*
+ * The digitized sounds are played at their original rate straight from
+ * the page file, the mixer resamples them.  A chunk is set up on first use
+ * or when a level that needs it is set up.  With --pagecache, pages can be
+ * dropped while a sound still plays, so the samples are copied, and with
+ * --soundcache the least recently used copies that are not playing are
+ * dropped again to stay within the budget.
+ */
 static Mix_Chunk *SoundChunks[ STARTMUSIC - STARTDIGISOUNDS];
-static byte      *SoundBuffers[STARTMUSIC - STARTDIGISOUNDS];
+static uint32_t   SoundLastUse[STARTMUSIC - STARTDIGISOUNDS];
+static uint32_t   SoundUseCount;
+static size_t     SoundCacheBytes, SoundCachePeak;
+static unsigned   SoundsPrepared, SoundsEvicted;
 
 globalsoundpos channelSoundPos[MIX_CHANNELS];
 
@@ -153,89 +143,129 @@ int SD_GetChannelForDigi(int which)
    return channel;
 }
 
+/* turns the positions of the game, 0 for loudest to 15 for silent on each
+   side, into the gains the mixer applies while it mixes the channel */
 void SD_SetPosition(int channel, int leftpos, int rightpos)
 {
+   if(leftpos < 0 || leftpos > 15 || rightpos < 0 || rightpos > 15
+         || (leftpos == 15 && rightpos == 15))
+      Quit("SD_SetPosition: Illegal position");
+
+   Mix_SetPanning(channel, ((15 - leftpos) << 4) + 15,
+         ((15 - rightpos) << 4) + 15);
 }
 
-static int16_t GetSample(float csample, byte *samples, int size)
+/* true while a channel still plays the prepared sound */
+static boolean SD_SoundInUse(int which)
 {
-   float val;
-   int32_t intval;
-   float s0=0, s1=0, s2=0;
-   int cursample = (int) csample;
-   float sf = csample - (float) cursample;
-
-   if(cursample-1 >= 0)
-      s0 = (float) (samples[cursample-1] - 128);
+   int i;
 
-   s1 = (float) (samples[cursample] - 128);
+   for(i = 0; i < MIX_CHANNELS; i++)
+   {
+      if(Mix_Playing(i) && Mix_GetChunk(i) == SoundChunks[which])
+         return true;
+   }
+   return false;
+}
 
-   if(cursample+1 < size)
-      s2 = (float) (samples[cursample+1] - 128);
+/*
+ * Drops the least recently used copied sounds that are not playing until
+ * needed more bytes fit into the budget.  If the playing ones alone exceed it,
+ * the cache grows over budget instead.
+ */
+static void SD_EvictSounds(size_t needed)
+{
+   int i, oldest;
 
-   val    = s0*sf*(sf-1)/2 - s1*(sf*sf-1) + s2*(sf+1)*sf/2;
-   intval = (int32_t) (val * 256);
+   while(SoundCacheBytes + needed > (size_t) param_soundcache * 1024)
+   {
+      oldest = -1;
+      for(i = 0; i < NumDigi; i++)
+      {
+         if(SoundChunks[i] && SoundChunks[i]->allocated
+               && (oldest == -1 || SoundLastUse[i] < SoundLastUse[oldest])
+               && !SD_SoundInUse(i))
+            oldest = i;
+      }
+      if(oldest == -1)
+         break;
 
-   if(intval < -32768)
-      intval = -32768;
-   else if(intval > 32767)
-      intval = 32767;
-   return (int16_t) intval;
+      SoundCacheBytes -= SoundChunks[oldest]->alen;
+      Mix_FreeChunk(SoundChunks[oldest]);
+      SoundChunks[oldest] = NULL;
+      SoundsEvicted++;
+   }
 }
 
+/*
+ * Sets up the chunk of digitized sound which, unless that is done already,
+ * and marks it as just used.  Its pages are pinned until the caller unpins
+ * them.
+ */
 void SD_PrepareSound(int which)
 {
-   unsigned i;
    int page, size;
-   int destsamples;
-   byte *origsamples;
-   byte *wavebuffer;
-   int16_t *newsamples;
-   float samplestep;
-   float cursample = 0.F;
+   byte *samples;
+   boolean copy = PMCaching;
 
    if(DigiList == NULL)
       Quit("SD_PrepareSound(%i): DigiList not initialized!\n", which);
 
-   page = DigiList[which].startpage;
-   size = DigiList[which].length;
-
-   origsamples = PM_GetSound(page);
-   if(origsamples + size >= PM_GetEnd())
-      Quit("SD_PrepareSound(%i): Sound reaches out of page file!\n", which);
-
-   destsamples = (int) ((float) size * (float)44100
-         / (float) ORIGSAMPLERATE);
+   SoundLastUse[which] = ++SoundUseCount;
+   if(SoundChunks[which])
+      return;
 
-   wavebuffer = (byte *)malloc(sizeof(headchunk) + sizeof(wavechunk)
-         + destsamples * 2);     /* dest are 16-bit samples */
-   if(wavebuffer == NULL)
-      Quit("Unable to allocate wave buffer for sound %i!\n", which);
+   LR_TRACE_BEGIN("SD_PrepareSound");
 
-   headchunk head = {{'R','I','F','F'}, 0, {'W','A','V','E'},
-      {'f','m','t',' '}, 0x10, 0x0001, 1, 44100, 44100 * 2, 2, 16};
-   head.filelenminus8 = sizeof(head) + destsamples*2;  /* (sizeof(dhead)-8 = 0) */
+   page = DigiList[which].startpage;
+   size = DigiList[which].length;
 
-   wavechunk dhead = {{'d', 'a', 't', 'a'}, destsamples*2};
+   if(copy && param_soundcache)
+      SD_EvictSounds(size);
 
-   memcpy(wavebuffer, &head, sizeof(head));
-   memcpy(wavebuffer+sizeof(head), &dhead, sizeof(dhead));
+   samples = PM_GetPages(PMSoundStart + page, size);
+   if(copy)
+   {
+      byte *pages = samples;
 
-   /* alignment is correct, as wavebuffer comes from malloc
-    * and sizeof(headchunk) % 4 == 0 and sizeof(wavechunk) % 4 == 0 */
-   newsamples = (int16_t *)(void *) (wavebuffer + sizeof(headchunk)
-         + sizeof(wavechunk));
-   samplestep = (float) ORIGSAMPLERATE / (float)44100;
+      samples = (byte *) malloc(size ? size : 1);
+      CHECKMALLOCRESULT(samples);
+      memcpy(samples, pages, size);
+   }
 
-   for(i=0; i<destsamples; i++, cursample+=samplestep)
+   SoundChunks[which] = Mix_QuickLoad_U8(samples, size, ORIGSAMPLERATE);
+   if(!SoundChunks[which])
    {
-      newsamples[i] = GetSample((float)size * (float)i / (float)destsamples,
-            origsamples, size);
+      if(copy)
+         free(samples);
+   }
+   else
+   {
+      SoundsPrepared++;
+      if(copy)
+      {
+         /* Mix_FreeChunk frees the copy */
+         SoundChunks[which]->allocated = 1;
+         SoundCacheBytes += size;
+         if(SoundCacheBytes > SoundCachePeak)
+            SoundCachePeak = SoundCacheBytes;
+      }
    }
-   SoundBuffers[which] = wavebuffer;
 
-   SoundChunks[which] = Mix_LoadWAV_RW(SDL_RWFromMem(wavebuffer,
-            sizeof(headchunk) + sizeof(wavechunk) + destsamples * 2), 1);
+   LR_TRACE_END("SD_PrepareSound");
+}
+
+/*
+ * Prepares the digitized version of sound ahead of its first play, if it
+ * has one and digitized sound is on.  The pages are not kept pinned.
+ */
+void SD_PrefetchSound(soundnames sound)
+{
+   if(DigiMode == SDS_OFF || DigiMap[sound] == -1)
+      return;
+
+   SD_PrepareSound(DigiMap[sound]);
+   PM_UnpinPages();
 }
 
 int SD_PlayDigitized(word which,int leftpos,int rightpos)
@@ -246,6 +276,8 @@ int SD_PlayDigitized(word which,int leftpos,int rightpos)
    if (which >= NumDigi)
       Quit("SD_PlayDigitized: bad sound number %i", which);
 
+   SD_PrepareSound(which);
+
    int channel = SD_GetChannelForDigi(which);
    SD_SetPosition(channel, leftpos,rightpos);
 
@@ -350,6 +382,7 @@ static void SD_SetupDigi(void)
 
       DigiList[i].length = size;
    }
+   PM_UnpinPages();
 
    for(i = 0; i < LASTSOUND; i++)
    {
@@ -579,7 +612,7 @@ boolean SD_SetMusicMode(SMMode mode)
 
    SD_FadeOutMusic();
    while (SD_MusicPlaying())
-      rarch_sleep(5);
+      LR_Delay(5);
 
    switch (mode)
    {
@@ -741,13 +774,18 @@ void SD_Shutdown(void)
    SD_MusicOff();
    SD_StopSound();
 
+   if(param_soundcache)
+      printf("Sound cache: %u sounds prepared, %u evictions, %u of %u KB used at most\n",
+            SoundsPrepared, SoundsEvicted, (unsigned) ((SoundCachePeak + 1023) / 1024),
+            (unsigned) param_soundcache);
+
    for(i = 0; i < STARTMUSIC - STARTDIGISOUNDS; i++)
    {
       if(SoundChunks[i])
          Mix_FreeChunk(SoundChunks[i]);
-      if(SoundBuffers[i])
-         free(SoundBuffers[i]);
+      SoundChunks[i] = NULL;
    }
+   SoundCacheBytes = 0;
 
    free(DigiList);
 
@@ -897,7 +935,7 @@ void
 SD_WaitSoundDone(void)
 {
    while (SD_SoundPlaying())
-      rarch_sleep(5);
+      LR_Delay(5);
 }
 
 ///////////////////////////////////////////////////////////////////////////
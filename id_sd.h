@@ -125,12 +125,12 @@ extern  SMMode          MusicMode;
 extern  int             DigiMap[];
 extern  int             DigiChannel[];
 
-#define GetTimeCount()  ((LR_GetTicks()*7)/100)
+#define GetTimeCount()  ((LR_GetGameTicks()*7)/100)
 
 static inline void Delay(int wolfticks)
 {
    if(wolfticks>0)
-      rarch_sleep(wolfticks * 100 / 7);
+      LR_Delay(wolfticks * 100 / 7);
 }
 
 // Function prototypes
@@ -157,6 +157,7 @@ extern  word    SD_SoundPlaying(void);
 
 extern  void    SD_SetDigiDevice(SDSMode);
 extern  void    SD_PrepareSound(int which);
+extern  void    SD_PrefetchSound(soundnames sound);
 extern  int     SD_PlayDigitized(word which,int leftpos,int rightpos);
 extern  void    SD_StopDigitized(void);
 
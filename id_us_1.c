@@ -719,7 +719,7 @@ US_LineInput(int x,int y,char *buf,const char *def,boolean escok,
 
          cursorvis ^= true;
       }
-      else rarch_sleep(5);
+      else LR_Delay(5);
       if (cursorvis)
          USL_XORICursor(x,y,s,cursor);
 
@@ -750,7 +750,7 @@ US_LineInput(int x,int y,char *buf,const char *def,boolean escok,
 void US_InitRndT(int randomize)
 {
    if(randomize)
-      rndindex = (LR_GetTicks() >> 4) & 0xff;
+      rndindex = (LR_GetGameTicks() >> 4) & 0xff;
    else
       rndindex = 0;
 }
@@ -0,0 +1,240 @@
+// ID_VF.C
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include "wl_def.h"
+
+/*
+=============================================================================
+
+                               VIRTUAL FILES
+
+The game data files are only ever read, so a mounted block is used in
+place: VF_Span hands out pointers into it and reads become pointer
+arithmetic.  Every VF_Open gets its own position, so threads can read
+the same file through their own handles.  Mounting is done before the
+game starts and unmounting after it ended, so the table is not locked.
+
+=============================================================================
+*/
+
+typedef struct
+{
+   char        name[16];
+   const byte *data;
+   size_t      size;
+} vfmount;
+
+struct vfile
+{
+   const byte *data;          // the mounted block, NULL for files on disk
+   FILE       *stream;        // the open file, NULL for mounted blocks
+   long        size, pos;
+};
+
+static vfmount vfmounts[MAXVFMOUNTS];
+static int     numvfmounts;
+
+/* the frontend may not keep the case of the original names */
+static boolean VF_SameName (const char *a, const char *b)
+{
+   for (; *a && *b; a++, b++)
+   {
+      if (tolower((unsigned char) *a) != tolower((unsigned char) *b))
+         return false;
+   }
+   return *a == *b;
+}
+
+static vfmount *VF_FindMount (const char *name)
+{
+   int i;
+
+   for (i = 0; i < numvfmounts; i++)
+   {
+      if (VF_SameName(vfmounts[i].name, name))
+         return &vfmounts[i];
+   }
+   return NULL;
+}
+
+/*
+===================
+=
+= VF_Mount
+=
+= Serves name from size bytes at data, replacing an earlier mount of the
+= same name.  Returns false if the name is too long or the table is full.
+=
+===================
+*/
+
+boolean VF_Mount (const char *name, const void *data, size_t size)
+{
+   vfmount *mount = VF_FindMount(name);
+
+   if (strlen(name) >= sizeof(mount->name) || size > LONG_MAX)
+      return false;
+
+   if (!mount)
+   {
+      if (numvfmounts == MAXVFMOUNTS)
+         return false;
+      mount = &vfmounts[numvfmounts++];
+   }
+
+   strcpy(mount->name, name);
+   mount->data = (const byte *) data;
+   mount->size = size;
+   return true;
+}
+
+void VF_UnmountAll (void)
+{
+   memset(vfmounts, 0, sizeof(vfmounts));
+   numvfmounts = 0;
+}
+
+boolean VF_Exists (const char *name)
+{
+   struct stat statbuf;
+
+   return VF_FindMount(name) || !stat(name, &statbuf);
+}
+
+/*
+===================
+=
+= VF_Open
+=
+= Opens the mounted block called name, or else the file, NULL if neither
+= is there
+=
+===================
+*/
+
+vfile *VF_Open (const char *name)
+{
+   vfmount *mount = VF_FindMount(name);
+   vfile   *file  = (vfile *) malloc(sizeof(*file));
+   CHECKMALLOCRESULT(file);
+
+   file->pos = 0;
+
+   if (mount)
+   {
+      file->data   = mount->data;
+      file->stream = NULL;
+      file->size   = (long) mount->size;
+      return file;
+   }
+
+   file->data   = NULL;
+   file->stream = fopen(name, "rb");
+   if (!file->stream)
+   {
+      free(file);
+      return NULL;
+   }
+
+   fseek(file->stream, 0, SEEK_END);
+   file->size = ftell(file->stream);
+   fseek(file->stream, 0, SEEK_SET);
+   return file;
+}
+
+void VF_Close (vfile *file)
+{
+   if (!file)
+      return;
+
+   if (file->stream)
+      fclose(file->stream);
+   free(file);
+}
+
+long VF_Size (vfile *file)
+{
+   return file->size;
+}
+
+void VF_Seek (vfile *file, long pos)
+{
+   file->pos = pos;
+   if (file->stream)
+      fseek(file->stream, pos, SEEK_SET);
+}
+
+/*
+===================
+=
+= VF_Read
+=
+= Reads up to size bytes from the current position, returns how many
+=
+===================
+*/
+
+long VF_Read (vfile *file, void *buffer, long size)
+{
+   long avail = file->pos >= 0 && file->pos < file->size ? file->size - file->pos : 0;
+
+   if (size > avail)
+      size = avail;
+   if (size <= 0)
+      return 0;
+
+   if (file->stream)
+      size = (long) fread(buffer, 1, size, file->stream);
+   else
+      memcpy(buffer, file->data + file->pos, size);
+
+   file->pos += size;
+   return size;
+}
+
+/*
+===================
+=
+= VF_Span
+=
+= Returns size bytes from pos.  For a mounted block that is a pointer
+= into it, otherwise they are read into buffer, which is returned and
+= needs room for all of them.  Whatever lies past the end of the file
+= reads as zeros.
+=
+===================
+*/
+
+boolean VF_InMemory (vfile *file, long pos, long size)
+{
+   return !file->stream && pos >= 0 && pos <= file->size && size <= file->size - pos;
+}
+
+const void *VF_Span (vfile *file, long pos, long size, void *buffer)
+{
+   long got;
+
+   if (VF_InMemory(file, pos, size))
+   {
+      file->pos = pos + size;
+      return file->data + pos;
+   }
+
+   VF_Seek(file, pos);
+   got = VF_Read(file, buffer, size);
+   if (got < size)
+      memset((byte *) buffer + got, 0, size - got);
+   return buffer;
+}
+
+const void *VF_Memory (vfile *file)
+{
+   return file->data;
+}
+
+FILE *VF_Stream (vfile *file)
+{
+   return file->stream;
+}
@@ -0,0 +1,34 @@
+#ifndef __ID_VF__
+#define __ID_VF__
+
+#include "boolean.h"
+
+// Virtual files.  Blocks of memory can be mounted under a file name, for
+// example the content the frontend loaded, and opening that name then
+// reads from the block instead of the file system.  Names that are not
+// mounted are opened as files like before.
+
+#define MAXVFMOUNTS 16
+
+typedef struct vfile vfile;
+
+// The data is not copied and has to stay valid until it is unmounted
+boolean VF_Mount(const char *name, const void *data, size_t size);
+void VF_UnmountAll(void);
+boolean VF_Exists(const char *name);
+
+vfile *VF_Open(const char *name);
+void VF_Close(vfile *file);
+long VF_Size(vfile *file);
+void VF_Seek(vfile *file, long pos);
+long VF_Read(vfile *file, void *buffer, long size);
+const void *VF_Span(vfile *file, long pos, long size, void *buffer);
+// True if VF_Span of the same bytes needs no buffer
+boolean VF_InMemory(vfile *file, long pos, long size);
+
+// The whole file when it is mounted, NULL when it is read from disk
+const void *VF_Memory(vfile *file);
+// The open file when it is read from disk, NULL when it is mounted
+FILE *VF_Stream(vfile *file);
+
+#endif
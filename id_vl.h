@@ -21,9 +21,7 @@ void Quit (const char *error,...);
 
 //===========================================================================
 
-#ifndef __LIBRETRO__
 extern LR_Surface *screen;
-#endif
 extern LR_Surface *screenBuffer;
 
 extern  boolean  fullscreen;
@@ -78,6 +76,7 @@ void VL_DrawPicBare             (int x, int y, byte *pic, int width, int height)
 void VL_MemToLatch              (byte *source, int width, int height,
                                     LR_Surface *destSurface, int x, int y);
 void VL_ScreenToScreen          (LR_Surface *source, LR_Surface *dest);
+void VL_ConvertScreen           (LR_Surface *source, LR_Surface *dest);
 void VL_MemToScreenScaledCoord  (byte *source, int width, int height, int scx, int scy);
 void VL_MemToScreenScaledCoord2  (byte *source, int origwidth, int origheight, int srcx, int srcy,
                                     int destx, int desty, int width, int height);
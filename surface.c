@@ -16,6 +16,10 @@
 #include <time.h>
 #endif
 
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
 #include "surface.h"
 #include "SDL.h"
 
@@ -102,12 +106,56 @@ static retro_perf_tick_t rarch_get_perf_counter(void)
    time_ticks = (1000000 * tv_sec + tv_usec);
 #endif
 
-   return time_ticks / 1000000;
+   return time_ticks;
+}
+
+/**
+ * get_monotonic_ns:
+ *
+ * Unlike rarch_get_perf_counter, whose unit depends on the platform
+ * (rdtsc cycles under MinGW, milliseconds under MSVC), this is always
+ * nanoseconds where a clock with a known rate exists.  Other platforms
+ * get the raw counter.
+ **/
+static uint64_t get_monotonic_ns(void)
+{
+#if defined(_WIN32)
+   static LARGE_INTEGER freq;
+   LARGE_INTEGER count;
+
+   if (!freq.QuadPart)
+      QueryPerformanceFrequency(&freq);
+   QueryPerformanceCounter(&count);
+
+   /* split up so the multiplication can't overflow */
+   return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000 +
+      (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+#elif defined(__linux__) || defined(__QNX__) || defined(__MACH__) || defined(__unix__)
+   struct timespec tv;
+
+   if (clock_gettime(CLOCK_MONOTONIC, &tv) != 0)
+      return 0;
+   return (uint64_t)tv.tv_sec * 1000000000 + (uint64_t)tv.tv_nsec;
+#elif defined(PSP) || defined(VITA) || defined(__mips__)
+   return rarch_get_perf_counter() * 1000;   /* microseconds */
+#else
+   return rarch_get_perf_counter();
+#endif
 }
 
 uint32_t LR_GetTicks(void)
 {
-   return (uint32_t)rarch_get_perf_counter();
+   return (uint32_t)(rarch_get_perf_counter() / 1000000);
+}
+
+uint64_t LR_GetMicroTicks(void)
+{
+   return get_monotonic_ns() / 1000;
+}
+
+uint64_t LR_GetPerfCounter(void)
+{
+   return get_monotonic_ns();
 }
 
 void LR_FillRect(LR_Surface *surface, const void *rect_data, uint32_t color)
@@ -122,8 +170,32 @@ void LR_FillRect(LR_Surface *surface, const void *rect_data, uint32_t color)
       }
 }
 
+/*
+ * A frame driven game only moves on with the frames retro_run runs, so
+ * fast forward, pausing and run-ahead of the frontend apply to it.
+ */
+uint32_t LR_GetGameTicks(void)
+{
+#ifdef __LIBRETRO__
+   if (LR_FrameDriven())
+      return LR_FrameTime();
+#endif
+   return LR_GetTicks();
+}
+
 void LR_Delay(uint32_t ms)
 {
+#ifdef __LIBRETRO__
+   uint32_t start = LR_GetGameTicks();
+
+   /* waiting in the game thread means running frames until the time is up */
+   if (LR_FrameDriven())
+   {
+      while (LR_GetGameTicks() - start < ms)
+         LR_YieldFrame();
+      return;
+   }
+#endif
    rarch_sleep(ms);
 }
 
@@ -179,7 +251,8 @@ int LR_BlitSurface(LR_Surface *lr_src, SDL_Rect *srcrect, LR_Surface *lr_dst, SD
 int LR_Flip(LR_Surface *screen)
 {
 #ifdef __LIBRETRO__
-   /* video_cb call here */
+   /* retro_run hands screen straight to video_cb */
+   LR_PresentFrame();
    return 0;
 #else
    return SDL_Flip(screen->surf);
@@ -34,6 +34,15 @@ typedef struct LR_Color
 
 uint32_t LR_GetTicks(void);
 
+/* milliseconds of game time, which under libretro only pass with frames */
+uint32_t LR_GetGameTicks(void);
+
+/* monotonic microseconds, for timing that needs more than milliseconds */
+uint64_t LR_GetMicroTicks(void);
+
+/* the same clock in nanoseconds */
+uint64_t LR_GetPerfCounter(void);
+
 void LR_FillRect(LR_Surface *surface, const void *rect_data, uint32_t color);
 
 void LR_Delay(Uint32 ms);
@@ -61,6 +70,17 @@ int LR_BlitSurface(LR_Surface *src, SDL_Rect *srcrect, LR_Surface *dst, SDL_Rect
 
 int LR_Flip(LR_Surface *screen);
 
+#ifdef __LIBRETRO__
+/* implemented by the libretro frontend glue in wl_main.c */
+int LR_FrameDriven(void);
+
+void LR_YieldFrame(void);
+
+void LR_PresentFrame(void);
+
+uint32_t LR_FrameTime(void);
+#endif
+
 SDL_Surface *LR_SetVideoMode(int width, int height, int bpp, uint32_t flags);
 
 SDL_Surface *LR_ConvertSurface(LR_Surface *src, SDL_PixelFormat *fmt, uint32_t flags);
@@ -0,0 +1,368 @@
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef HAVE_THREADS
+#include <rthreads/rthreads.h>
+#endif
+
+#include "surface.h"
+#include "trace.h"
+#include "tasks.h"
+
+#if defined(_MSC_VER)
+#define TASK_THREAD_LOCAL __declspec(thread)
+#else
+#define TASK_THREAD_LOCAL __thread
+#endif
+
+typedef enum
+{
+   TASK_WAITING,
+   TASK_RUNNING,
+   TASK_DONE
+} taskstate_t;
+
+typedef struct
+{
+   const char  *name;
+   void       (*func)(int arg);
+   int          arg;
+   int          waitfor;             /* tasks this one depends on that are not done */
+   uint64_t     dependents;          /* bit i set if task i depends on this one */
+   taskstate_t  state;
+   int          thread;
+   uint64_t     start, end;
+} task_t;
+
+static task_t   tasks[MAXTASKS];
+static int      numtasks;
+static int      numdone, numrunning;
+static char     taskerror[256];
+static int      taskfailed;
+static uint64_t taskstart;
+
+#ifdef HAVE_THREADS
+static slock_t *tasklock;
+static scond_t *taskcond;
+#endif
+
+/* where a Quit returns to, NULL while the thread is not in LR_TaskCatch */
+typedef struct
+{
+   jmp_buf  back;
+   char    *error;
+   size_t   size;
+} taskcatch_t;
+
+static TASK_THREAD_LOCAL taskcatch_t *taskexit;
+static TASK_THREAD_LOCAL int          taskgamethread;
+
+/*
+ * Adds a task that calls func(arg) and returns its number.  Without room
+ * for it, LR_TaskRun fails without running anything.
+ */
+int LR_TaskAdd(const char *name, void (*func)(int arg), int arg)
+{
+   task_t *task;
+
+   if (numtasks == MAXTASKS)
+   {
+      snprintf(taskerror, sizeof(taskerror), "LR_TaskAdd: More than %i tasks!", MAXTASKS);
+      taskfailed = 1;
+      return -1;
+   }
+
+   task = &tasks[numtasks];
+   memset(task, 0, sizeof(*task));
+   task->name = name;
+   task->func = func;
+   task->arg  = arg;
+   return numtasks++;
+}
+
+/* task waits until on is done, on must have been added first */
+void LR_TaskDepends(int task, int on)
+{
+   uint64_t bit;
+
+   if (task < 0 || on < 0 || on >= task)
+      return;
+
+   bit = (uint64_t)1 << task;
+   if (!(tasks[on].dependents & bit))
+   {
+      tasks[on].dependents |= bit;
+      tasks[task].waitfor++;
+   }
+}
+
+/*
+ * Called by Quit before it shuts anything down: inside LR_TaskCatch the
+ * caught function ends and its caller gets the error.  Returns if the
+ * thread isn't in LR_TaskCatch.
+ */
+void LR_TaskAbort(const char *error)
+{
+   if (!taskexit)
+      return;
+
+   snprintf(taskexit->error, taskexit->size, "%s", error ? error : "");
+   longjmp(taskexit->back, 1);
+}
+
+/*
+ * Runs func(data) so that a Quit in it only ends func.  Returns 0 once
+ * func returned, or 1 with the error in error.
+ */
+int LR_TaskCatch(void (*func)(void *data), void *data, char *error, size_t size)
+{
+   taskcatch_t  frame;
+   taskcatch_t *outer  = taskexit;
+   int          failed = 0;
+
+   frame.error = error;
+   frame.size  = size;
+   taskexit    = &frame;
+   if (!setjmp(frame.back))
+      func(data);
+   else
+      failed = 1;
+   taskexit = outer;
+   return failed;
+}
+
+/* marks the calling thread as the one that runs the game and shuts it down */
+void LR_TaskGameThread(void)
+{
+   taskgamethread = 1;
+}
+
+int LR_TaskIsGameThread(void)
+{
+   return taskgamethread;
+}
+
+static void TaskCall(void *data)
+{
+   task_t *task = (task_t *)data;
+
+   LR_TRACE_BEGIN(task->name);
+   task->func(task->arg);
+   LR_TRACE_END(task->name);
+}
+
+/*
+ * A task that quits ends, no further tasks are started and LR_TaskRun
+ * returns the error once the running ones are done.
+ */
+static void TaskExecute(task_t *task)
+{
+   char error[256];
+
+   if (!LR_TaskCatch(TaskCall, task, error, sizeof(error)))
+      return;
+
+#ifdef HAVE_THREADS
+   if (tasklock)
+      slock_lock(tasklock);
+#endif
+   if (!taskfailed)
+   {
+      snprintf(taskerror, sizeof(taskerror), "%s", error);
+      taskfailed = 1;
+   }
+#ifdef HAVE_THREADS
+   if (tasklock)
+      slock_unlock(tasklock);
+#endif
+}
+
+/*
+ * Takes the lowest numbered task whose dependencies are done, so a single
+ * thread runs them in the order they were added.  Returns -1 if there is
+ * none right now.
+ */
+static int TaskNext(void)
+{
+   int i;
+
+   if (taskfailed)
+      return -1;
+
+   for (i = 0; i < numtasks; i++)
+   {
+      if (tasks[i].state == TASK_WAITING && !tasks[i].waitfor)
+         return i;
+   }
+   return -1;
+}
+
+static void TaskFinish(int i)
+{
+   int j;
+
+   tasks[i].end   = LR_GetMicroTicks();
+   tasks[i].state = TASK_DONE;
+   numdone++;
+   numrunning--;
+
+   for (j = i + 1; j < numtasks; j++)
+   {
+      if (tasks[i].dependents & ((uint64_t)1 << j))
+         tasks[j].waitfor--;
+   }
+}
+
+#ifdef HAVE_THREADS
+static void TaskWorker(void *data)
+{
+   int thread = (int)(intptr_t)data;
+   int i;
+
+   if (thread)
+      LR_TraceThreadName("startup");
+
+   slock_lock(tasklock);
+   for (;;)
+   {
+      i = TaskNext();
+      if (i == -1)
+      {
+         /* done, failed or stuck on a cycle once nothing runs */
+         if (!numrunning)
+            break;
+         scond_wait(taskcond, tasklock);
+         continue;
+      }
+
+      tasks[i].state  = TASK_RUNNING;
+      tasks[i].thread = thread;
+      tasks[i].start  = LR_GetMicroTicks();
+      numrunning++;
+      slock_unlock(tasklock);
+
+      TaskExecute(&tasks[i]);
+
+      slock_lock(tasklock);
+      TaskFinish(i);
+      scond_broadcast(taskcond);
+   }
+   scond_broadcast(taskcond);
+   slock_unlock(tasklock);
+}
+#endif
+
+static void TaskRunSerially(void)
+{
+   int i;
+
+   while ((i = TaskNext()) != -1)
+   {
+      tasks[i].state  = TASK_RUNNING;
+      tasks[i].start  = LR_GetMicroTicks();
+      numrunning++;
+      TaskExecute(&tasks[i]);
+      TaskFinish(i);
+   }
+}
+
+static void TaskLog(int numthreads)
+{
+   int i;
+
+   printf("Startup: %i tasks on %i thread%s in %.1f ms\n", numtasks, numthreads,
+         numthreads == 1 ? "" : "s", (LR_GetMicroTicks() - taskstart) / 1000.0);
+
+   for (i = 0; i < numtasks; i++)
+   {
+      if (tasks[i].state != TASK_DONE)
+         continue;
+      printf("   %-20s thread %2i  at %7.1f ms  took %7.1f ms\n", tasks[i].name, tasks[i].thread,
+            (tasks[i].start - taskstart) / 1000.0, (tasks[i].end - tasks[i].start) / 1000.0);
+   }
+}
+
+/* the threads LR_TaskRun(numthreads) uses at most, 0 for one per CPU */
+int LR_TaskThreads(int numthreads)
+{
+#ifdef HAVE_THREADS
+   if (numthreads < 1)
+      numthreads = sthread_num_cpus();
+#endif
+   if (numthreads > MAXTASKTHREADS)
+      numthreads = MAXTASKTHREADS;
+   if (numthreads < 1)
+      numthreads = 1;
+   return numthreads;
+}
+
+/*
+ * Runs every task added so far on numthreads threads, the calling thread
+ * being one of them, and forgets them again.  Returns NULL once all are
+ * done, or the error of the first task that aborted.
+ */
+const char *LR_TaskRun(int numthreads)
+{
+#ifdef HAVE_THREADS
+   sthread_t *threads[MAXTASKTHREADS];
+#endif
+   int i, failed;
+
+   numthreads = LR_TaskThreads(numthreads);
+   if (numthreads > numtasks)
+      numthreads = numtasks > 0 ? numtasks : 1;
+
+   numdone   = numrunning = 0;
+   taskstart = LR_GetMicroTicks();
+
+#ifdef HAVE_THREADS
+   if (numthreads > 1)
+   {
+      tasklock = slock_new();
+      taskcond = scond_new();
+   }
+
+   if (tasklock && taskcond)
+   {
+      for (i = 1; i < numthreads; i++)
+      {
+         threads[i] = sthread_create(TaskWorker, (void *)(intptr_t)i);
+         if (!threads[i])
+            break;
+      }
+      numthreads = i;
+
+      TaskWorker(NULL);
+
+      for (i = 1; i < numthreads; i++)
+         sthread_join(threads[i]);
+   }
+   else
+      numthreads = 1;
+
+   scond_free(taskcond);
+   slock_free(tasklock);
+   taskcond = NULL;
+   tasklock = NULL;
+#else
+   numthreads = 1;
+#endif
+
+   /* what the threads left over, if they could not be started */
+   TaskRunSerially();
+
+   TaskLog(numthreads);
+
+   if (!taskfailed && numdone != numtasks)
+   {
+      snprintf(taskerror, sizeof(taskerror), "LR_TaskRun: The startup tasks depend on each other!");
+      taskfailed = 1;
+   }
+
+   failed     = taskfailed;
+   numtasks   = 0;
+   taskfailed = 0;
+   return failed ? taskerror : NULL;
+}
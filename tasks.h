@@ -0,0 +1,37 @@
+#ifndef _TASKS_H
+#define _TASKS_H
+
+/*
+ * A one-shot task graph.  Tasks are added with the tasks they have to wait
+ * for, then LR_TaskRun runs them on worker threads and the calling thread,
+ * each as soon as everything it depends on has finished, and logs how long
+ * every task took.  Task names must be string literals, they go into the
+ * trace as well.
+ *
+ * Only the thread marked with LR_TaskGameThread may shut the game down.
+ * Code that can quit on any other thread runs through LR_TaskCatch, which
+ * hands the error back instead, and tasks always do.
+ */
+
+#include <stddef.h>
+
+#define MAXTASKS        64
+#define MAXTASKTHREADS  16
+
+int LR_TaskAdd(const char *name, void (*func)(int arg), int arg);
+
+void LR_TaskDepends(int task, int on);
+
+int LR_TaskThreads(int numthreads);
+
+const char *LR_TaskRun(int numthreads);
+
+void LR_TaskAbort(const char *error);
+
+int LR_TaskCatch(void (*func)(void *data), void *data, char *error, size_t size);
+
+void LR_TaskGameThread(void);
+
+int LR_TaskIsGameThread(void);
+
+#endif
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+#include "surface.h"
+#include "trace.h"
+
+#if defined(_MSC_VER)
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL __thread
+#endif
+
+/* 16 startup workers, 16 render threads, the game, audio, map cache and
+ * frontend threads, and room for the workers of a reloaded game */
+#define MAXTRACETHREADS   64
+#define TRACEEVENTS       65536      /* per thread, must be a power of 2 */
+
+typedef struct
+{
+   const char *name;
+   uint64_t    time;
+   char        phase;
+} traceevent_t;
+
+typedef struct
+{
+   traceevent_t *events;
+   uint32_t      head;               /* events written, the ring keeps the last TRACEEVENTS */
+   const char   *threadname;
+} tracebuffer_t;
+
+volatile int lr_tracing;
+
+static char            tracefile[256];
+static uint64_t        tracestart;
+static tracebuffer_t   tracebuffers[MAXTRACETHREADS];
+static volatile long   numtracebuffers;
+
+/* handed to the threads that got no buffer, it records nothing */
+static tracebuffer_t   notracebuffer;
+
+static TRACE_THREAD_LOCAL tracebuffer_t *tracebuffer;
+
+/*
+ * Takes a slot the first time a thread traces.  A thread that gets none
+ * keeps notracebuffer, so it only tries once.
+ */
+static tracebuffer_t *GetTraceBuffer(void)
+{
+   long slot;
+
+   if (tracebuffer)
+      return tracebuffer;
+
+#if defined(_MSC_VER)
+   slot = InterlockedIncrement(&numtracebuffers) - 1;
+#else
+   slot = __sync_fetch_and_add(&numtracebuffers, 1);
+#endif
+   tracebuffer = &notracebuffer;
+
+   if (slot >= MAXTRACETHREADS)
+   {
+      if (slot == MAXTRACETHREADS)
+         printf("Trace: More than %i threads, the others are not recorded\n", MAXTRACETHREADS);
+      return tracebuffer;
+   }
+
+   tracebuffers[slot].events = (traceevent_t*)calloc(TRACEEVENTS, sizeof(traceevent_t));
+   if (tracebuffers[slot].events)
+      tracebuffer = &tracebuffers[slot];
+   return tracebuffer;
+}
+
+void LR_TraceStartup(const char *filename)
+{
+   if (!filename || !*filename)
+      return;
+
+   snprintf(tracefile, sizeof(tracefile), "%s", filename);
+   tracestart = LR_GetPerfCounter();
+   lr_tracing = 1;
+   LR_TraceThreadName("main");
+}
+
+void LR_TraceThreadName(const char *name)
+{
+   tracebuffer_t *buf;
+
+   if (!lr_tracing || !(buf = GetTraceBuffer())->events)
+      return;
+   buf->threadname = name;
+}
+
+void LR_TraceEvent(const char *name, char phase)
+{
+   tracebuffer_t *buf = GetTraceBuffer();
+   traceevent_t  *ev;
+
+   if (!buf->events)
+      return;
+
+   ev        = &buf->events[buf->head & (TRACEEVENTS - 1)];
+   ev->name  = name;
+   ev->time  = LR_GetPerfCounter();
+   ev->phase = phase;
+   buf->head++;
+}
+
+/*
+ * Called once every other thread that traced has been stopped.  Ends whose
+ * begin was dropped from the ring are left out.
+ */
+void LR_TraceShutdown(void)
+{
+   FILE *file;
+   long  i, numbuffers;
+   int   first = 1;
+
+   if (!lr_tracing)
+      return;
+   lr_tracing = 0;
+
+   numbuffers = numtracebuffers < MAXTRACETHREADS ? numtracebuffers : MAXTRACETHREADS;
+
+   file = fopen(tracefile, "w");
+   if (file)
+      fprintf(file, "{\"traceEvents\":[\n");
+
+   for (i = 0; i < numbuffers; i++)
+   {
+      tracebuffer_t *buf = &tracebuffers[i];
+      uint32_t       n   = buf->head < TRACEEVENTS ? buf->head : TRACEEVENTS;
+      uint32_t       e;
+      int            depth = 0;
+
+      if (!buf->events)
+         continue;
+
+      if (file && buf->threadname)
+      {
+         fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%ld,"
+               "\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", i + 1, buf->threadname);
+         first = 0;
+      }
+
+      for (e = buf->head - n; file && e != buf->head; e++)
+      {
+         traceevent_t *ev = &buf->events[e & (TRACEEVENTS - 1)];
+
+         if (ev->phase == 'E' && !depth)
+            continue;
+         depth += ev->phase == 'B' ? 1 : -1;
+
+         fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%ld}",
+               first ? "" : ",\n", ev->name, ev->phase,
+               (int64_t)(ev->time - tracestart) / 1000.0, i + 1);
+         first = 0;
+      }
+
+      free(buf->events);
+      buf->events = NULL;
+   }
+
+   if (file)
+   {
+      fprintf(file, "\n]}\n");
+      fclose(file);
+   }
+   else
+      printf("Unable to write trace file %s\n", tracefile);
+}
@@ -0,0 +1,25 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Chrome trace_event recorder.  Every thread writes begin/end events into a
+ * ring buffer of its own, the file is written by LR_TraceShutdown once the
+ * other threads are gone.  Event names must be string literals.
+ */
+
+extern volatile int lr_tracing;
+
+void LR_TraceStartup(const char *filename);
+
+void LR_TraceShutdown(void);
+
+void LR_TraceThreadName(const char *name);
+
+void LR_TraceEvent(const char *name, char phase);
+
+#define LR_TRACE_BEGIN(name) do { if (lr_tracing) LR_TraceEvent(name, 'B'); } while (0)
+#define LR_TRACE_END(name)   do { if (lr_tracing) LR_TraceEvent(name, 'E'); } while (0)
+
+#endif
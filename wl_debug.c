@@ -418,6 +418,18 @@ again:
     }
     else if (Keyboard[sc_Q])        // Q = fast quit
         Quit (NULL);
+    else if (Keyboard[sc_R])        // R = frame profiler
+    {
+        CenterWindow (18,2);
+        if (ProfOverlayShown())
+            US_PrintCentered ("Frame profiler OFF");
+        else
+            US_PrintCentered ("Frame profiler ON");
+        VW_UpdateScreen();
+        IN_Ack();
+        ProfToggleOverlay();
+        return 1;
+    }
     else if (Keyboard[sc_S])        // S = slow motion
     {
         CenterWindow(30,3);
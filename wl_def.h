@@ -71,6 +71,9 @@ typedef struct
 
 void Quit(const char *errorStr, ...);
 
+#include "trace.h"
+#include "id_vf.h"
+#include "id_pk.h"
 #include "id_pm.h"
 #include "id_sd.h"
 #include "id_in.h"
@@ -98,6 +101,16 @@ void Quit(const char *errorStr, ...);
 */
 
 #define DEMOTICS        4
+#ifndef SPEARDEMO
+#define NUMDEMOS        4
+#else
+#define NUMDEMOS        1
+#endif
+
+// param_mapcache
+#define MAPCACHE_OFF    0
+#define MAPCACHE_MEMORY 1
+#define MAPCACHE_DISK   2
 
 #define MAXACTORS       150         // max number of nazis, etc / map
 #define MAXSTATS        400         // max number of lamps, bonus, etc
@@ -895,6 +908,21 @@ extern  int      param_joystickhat;
 extern  int      param_mission;
 extern  boolean  param_goodtimes;
 extern  boolean  param_ignorenumchunks;
+extern  int      param_renderthreads;
+extern  int      param_scalercache;
+extern  boolean  param_transposedview;
+extern  boolean  param_incrementalview;
+extern  int      param_timedemo;
+extern  boolean  param_profile;
+extern  char     param_profilecsv[256];
+extern  char     param_trace[256];
+extern  boolean  param_mmapvswap;
+extern  int      param_pagecache;
+extern  int      param_soundcache;
+extern  boolean  param_huffbench;
+extern  int      param_mapcache;
+extern  boolean  param_buildpack;
+extern  int      param_startupthreads;
 
 
 void            NewGame (int difficulty,int episode);
@@ -928,6 +956,8 @@ void    ShowActStatus();
 
 void    PlayDemo (int demonumber);
 void    RecordDemo (void);
+void    TimeDemo (void);
+void    TimeDemoFrame (uint32_t usec);
 
 
 #ifdef SPEAR
@@ -1081,6 +1111,7 @@ extern  fixed   viewsin,viewcos;
 
 void    ThreeDRefresh (void);
 void    CalcTics (void);
+void    ShutdownRefreshThreads (void);
 
 typedef struct
 {
@@ -1301,6 +1332,55 @@ extern  char    helpfilename[],endfilename[];
 extern  void    HelpScreens(void);
 extern  void    EndText(void);
 
+/*
+=============================================================================
+
+                             WL_PROF DEFINITIONS
+
+=============================================================================
+*/
+
+enum
+{
+    prof_controls,          // PollControls
+    prof_doors,             // MoveDoors and MovePWalls
+    prof_actors,            // the DoActor loop
+    prof_palette,           // UpdatePaletteShifts
+    prof_walls,             // WallRefresh
+    prof_sprites,           // DrawScaleds
+    prof_weapon,            // DrawPlayerWeapon
+    prof_screen,            // VW_UpdateScreen
+    NUMPROFSTAGES
+};
+
+extern  boolean     profiling;
+extern  uint64_t    profstagetime[NUMPROFSTAGES];
+extern  const char *profstagenames[NUMPROFSTAGES];
+
+void    ProfStartup (void);
+void    ProfShutdown (void);
+void    ProfToggleOverlay (void);
+boolean ProfOverlayShown (void);
+void    ProfStartFrames (void);
+void    ProfFrameDone (void);
+void    ProfDrawOverlay (void);
+
+static inline uint64_t ProfBegin (int stage)
+{
+    if (!profiling)
+        return 0;
+    LR_TRACE_BEGIN(profstagenames[stage]);
+    return LR_GetPerfCounter();
+}
+
+static inline void ProfEnd (int stage, uint64_t start)
+{
+    if (!profiling)
+        return;
+    profstagetime[stage] += LR_GetPerfCounter() - start;
+    LR_TRACE_END(profstagenames[stage]);
+}
+
 
 
 /*
@@ -1327,7 +1407,7 @@ static inline fixed FixedMul(fixed a, fixed b)
 #endif
 #define DEMOCOND_SDL                   (!DEMOCOND_ORIG)
 
-#define GetTicks() ((LR_GetTicks()*7)/100)
+#define GetTicks() ((LR_GetGameTicks()*7)/100)
 
 #define ISPOINTER(x) ((((uintptr_t)(x)) & ~0xffff) != 0)
 
@@ -2,6 +2,10 @@
 
 #include "wl_def.h"
 #include "retro_endian.h"
+#ifdef HAVE_THREADS
+#include <rthreads/rthreads.h>
+#include "tasks.h"
+#endif
 
 /*
 =============================================================================
@@ -24,8 +28,18 @@
 =============================================================================
 */
 
+/*
+ * The 3D view is drawn at vbuf[y * vbufPitch + x * vbufColStep].
+ * Normally vbuf points into screenBuffer and vbufColStep is 1, with
+ * --transposedview it points to viewcolumns, which stores every column
+ * contiguously and is transposed into screenBuffer once per frame.
+ */
 static byte *vbuf = NULL;
 unsigned vbufPitch = 0;
+static unsigned vbufColStep = 1;
+
+static byte *viewcolumns;
+static unsigned viewcolumnssize;
 
 int32_t    lasttimecount;
 int32_t    frameon;
@@ -47,27 +61,62 @@ fixed   viewx,viewy; /* the focal point */
 short   viewangle;
 fixed   viewsin,viewcos;
 
-/* wall optimization variables */
-int     lastside;               /* true for vertical */
-int32_t    lastintercept;
-int     lasttilehit;
-int     lasttexture;
-
 /* ray tracing variables */
 short    focaltx,focalty,viewtx,viewty;
 longword xpartialup,xpartialdown,ypartialup,ypartialdown;
 
 short   midangle,angle;
 
-word    tilehit;
-int     pixx;
-
-short   xtile,ytile;
-short   xtilestep,ytilestep;
-int32_t    xintercept,yintercept;
 word    xstep,ystep;
-word    xspot,yspot;
-int     texdelta;
+
+#define MAXSCALERMISSES 32
+
+/* per ray state, one for each band of columns traced by AsmRefresh */
+typedef struct
+{
+   /* wall optimization variables */
+   int     lastside;            /* 0/1: horiz/vert wall, 2/3: horiz/vert door */
+   int32_t lastintercept;
+   int     lasttilehit;
+   int     lasttexture;
+
+   word    tilehit;
+   int     pixx;
+
+   short   xtile,ytile;
+   short   xtilestep,ytilestep;
+   int32_t xintercept,yintercept;
+   word    xspot,yspot;
+   int     texdelta;
+
+   /* the post waiting to be scaled */
+   byte    *postsource;
+   int     postx;
+
+   int     min_wallheight;
+
+   /* post heights that had no scaler, built once the frame is traced */
+   int     scalermisses[MAXSCALERMISSES];
+   int     numscalermisses;
+} raystate_t;
+
+/*
+ * A scaler holds the texel row of every screen row a wall post of one
+ * height covers, so ScalePost can simply gather from the texture column.
+ */
+typedef struct
+{
+   int     top;
+   int     count;
+   byte    *texel;
+} scaler_t;
+
+static scaler_t **scalers;          /* indexed by wallheight >> 3 */
+static int      numscalers;
+static byte     *scalerrows;
+static unsigned scalerbytes;
+static int      scalerviewheight;
+static int32_t  scalerheightnumerator;
 
 word horizwall[MAXWALLTILES],vertwall[MAXWALLTILES];
 
@@ -204,18 +253,18 @@ static boolean TransformTile (int tx, int ty, short *dispx, short *dispheight)
 ====================
 */
 
-static int CalcHeight(void)
+static int CalcHeight(raystate_t *rs)
 {
    int height;
-   fixed z = FixedMul(xintercept - viewx, viewcos) - FixedMul(yintercept - viewy, viewsin);
+   fixed z = FixedMul(rs->xintercept - viewx, viewcos) - FixedMul(rs->yintercept - viewy, viewsin);
 
    if (z < MINDIST)
       z = MINDIST;
 
    height = heightnumerator / (z >> 8);
 
-   if(height < min_wallheight)
-      min_wallheight = height;
+   if(height < rs->min_wallheight)
+      rs->min_wallheight = height;
 
    return height;
 }
@@ -223,20 +272,172 @@ static int CalcHeight(void)
 /*
 ===================
 =
-= ScalePost
+= FreeScalers
 =
 ===================
 */
 
-static byte *postsource;
-static int postx;
-static int postwidth;
+static void FreeScalers(void)
+{
+   int i;
+
+   for(i = 0; i < numscalers; i++)
+      free(scalers[i]);
+   free(scalers);
+   free(scalerrows);
+
+   scalers     = NULL;
+   scalerrows  = NULL;
+   numscalers  = 0;
+   scalerbytes = 0;
+}
 
-static void ScalePost(void)
+/*
+===================
+=
+= SetupScalers
+=
+= Throws the scalers away when the view size changed and makes room
+= for every post height that can be seen from MINDIST
+=
+===================
+*/
+
+static void SetupScalers(void)
+{
+   if(viewheight == scalerviewheight && heightnumerator == scalerheightnumerator)
+      return;
+
+   FreeScalers();
+   scalerviewheight      = viewheight;
+   scalerheightnumerator = heightnumerator;
+
+   if(!param_scalercache)
+      return;
+
+   numscalers = ((heightnumerator / (MINDIST >> 8)) >> 3) + 1;
+   scalers    = (scaler_t **) calloc(numscalers, sizeof(*scalers));
+   CHECKMALLOCRESULT(scalers);
+   scalerrows = (byte *) malloc(viewheight);
+   CHECKMALLOCRESULT(scalerrows);
+}
+
+/*
+===================
+=
+= BuildScaler
+=
+= Steps through a post of height yd exactly like ScalePostStepped
+= and remembers the texel of every row it would draw. Heights that
+= might not fit in the budget any more are not stepped at all
+=
+===================
+*/
+
+static void BuildScaler(int yd)
+{
+   int y, top, bottom, count;
+   int ywcount = yd;
+   int yw      = TEXTURESIZE-1;
+   scaler_t *scaler;
+
+   if(scalers[yd])
+      return;
+
+   count = yd * 2 < viewheight ? yd * 2 : viewheight;
+   if(scalerbytes + sizeof(*scaler) + count > (unsigned)param_scalercache * 1024)
+      return;                       /* over budget, keep stepping */
+
+   top = viewheight / 2 - ywcount;
+   if(top < 0)
+      top = 0;
+
+   y = viewheight / 2 + ywcount - 1;
+
+   while(y >= viewheight)
+   {
+      ywcount -= TEXTURESIZE/2;
+
+      while(ywcount <= 0)
+      {
+         ywcount += yd;
+         yw--;
+      }
+      y--;
+   }
+
+   bottom = y;
+
+   if(yw >= 0)
+   {
+      for(; y >= top; y--)
+      {
+         scalerrows[y]  = yw;
+         ywcount       -= TEXTURESIZE/2;
+
+         if(ywcount <= 0)
+         {
+            do
+            {
+               ywcount += yd;
+               yw--;
+            }while(ywcount <= 0);
+
+            if(yw < 0)
+               break;
+         }
+      }
+      if(y < top)
+         y = top;
+   }
+   else
+      y = bottom + 1;
+
+   count = bottom - y + 1;
+
+   scaler = (scaler_t *) malloc(sizeof(*scaler) + count);
+   CHECKMALLOCRESULT(scaler);
+   scaler->top   = y;
+   scaler->count = count;
+   scaler->texel = (byte *) (scaler + 1);
+   memcpy(scaler->texel, scalerrows + y, count);
+
+   scalerbytes += sizeof(*scaler) + count;
+   scalers[yd]  = scaler;
+}
+
+/*
+===================
+=
+= BuildMissedScalers
+=
+= Only called by the main thread while no band is being traced
+=
+===================
+*/
+
+static void BuildMissedScalers(raystate_t *rs)
+{
+   int i;
+
+   for(i = 0; i < rs->numscalermisses; i++)
+      BuildScaler(rs->scalermisses[i]);
+   rs->numscalermisses = 0;
+}
+
+/*
+===================
+=
+= ScalePostStepped
+=
+===================
+*/
+
+static void ScalePostStepped(raystate_t *rs)
 {
    int yoffs, yw, yd, yendoffs;
    byte col;
-   int ywcount = yd = wallheight[postx] >> 3;
+   int ywcount = yd = wallheight[rs->postx] >> 3;
 
    if(yd <= 0)
       yd      = 100;
@@ -246,7 +447,7 @@ static void ScalePost(void)
    if (yoffs < 0)
       yoffs   = 0;
 
-   yoffs     += postx;
+   yoffs     += rs->postx * vbufColStep;
 
    yendoffs   = viewheight / 2 + ywcount - 1;
    yw         = TEXTURESIZE-1;
@@ -266,8 +467,8 @@ static void ScalePost(void)
    if(yw < 0)
       return;
 
-   col      = postsource[yw];
-   yendoffs = yendoffs * vbufPitch + postx;
+   col      = rs->postsource[yw];
+   yendoffs = yendoffs * vbufPitch + rs->postx * vbufColStep;
 
    while(yoffs <= yendoffs)
    {
@@ -284,12 +485,47 @@ static void ScalePost(void)
 
          if(yw < 0)
             break;
-         col = postsource[yw];
+         col = rs->postsource[yw];
       }
       yendoffs -= vbufPitch;
    }
 }
 
+/*
+===================
+=
+= ScalePost
+=
+===================
+*/
+
+static void ScalePost(raystate_t *rs)
+{
+   int yd = wallheight[rs->postx] >> 3;
+
+   if(yd > 0 && yd < numscalers)
+   {
+      scaler_t *scaler = scalers[yd];
+
+      if(scaler)
+      {
+         int  i;
+         byte *texel = scaler->texel;
+         byte *dest  = vbuf + scaler->top * vbufPitch + rs->postx * vbufColStep;
+
+         for(i = 0; i < scaler->count; i++, dest += vbufPitch)
+            *dest = rs->postsource[texel[i]];
+         return;
+      }
+
+      if(rs->numscalermisses < MAXSCALERMISSES
+            && (!rs->numscalermisses || rs->scalermisses[rs->numscalermisses - 1] != yd))
+         rs->scalermisses[rs->numscalermisses++] = yd;
+   }
+
+   ScalePostStepped(rs);
+}
+
 /*
 ====================
 =
@@ -301,61 +537,59 @@ static void ScalePost(void)
 ====================
 */
 
-static void HitVertWall (void)
+static void HitVertWall (raystate_t *rs)
 {
    int wallpic;
-   int texture = ((yintercept+texdelta)>>TEXTUREFROMFIXEDSHIFT)&TEXTUREMASK;
+   int texture = ((rs->yintercept+rs->texdelta)>>TEXTUREFROMFIXEDSHIFT)&TEXTUREMASK;
 
-   if (xtilestep == -1)
+   if (rs->xtilestep == -1)
    {
       texture = TEXTUREMASK-texture;
-      xintercept += TILEGLOBAL;
+      rs->xintercept += TILEGLOBAL;
    }
 
-   if (lastside == 1 && lastintercept==xtile && lasttilehit==tilehit && !(lasttilehit & 0x40))
+   if (rs->lastside == 1 && rs->lastintercept==rs->xtile && rs->lasttilehit==rs->tilehit && !(rs->lasttilehit & 0x40))
    {
-      ScalePost();
+      ScalePost(rs);
 
-      if((pixx&3) && texture == lasttexture)
+      if((rs->pixx&3) && texture == rs->lasttexture)
       {
-         postx = pixx;
-         wallheight[pixx] = wallheight[pixx-1];
+         rs->postx = rs->pixx;
+         wallheight[rs->pixx] = wallheight[rs->pixx-1];
          return;
       }
 
-      wallheight[pixx]    = CalcHeight();
-      postsource         += texture-lasttexture;
-      postwidth           = 1;
-      postx               = pixx;
-      lasttexture         = texture;
+      wallheight[rs->pixx]    = CalcHeight(rs);
+      rs->postsource         += texture-rs->lasttexture;
+      rs->postx               = rs->pixx;
+      rs->lasttexture         = texture;
       return;
    }
 
-   if (lastside != -1)
-      ScalePost();
+   if (rs->lastside != -1)
+      ScalePost(rs);
 
-   lastside         = 1;
-   lastintercept    = xtile;
-   lasttilehit      = tilehit;
-   lasttexture      = texture;
-   wallheight[pixx] = CalcHeight();
-   postx            = pixx;
-   postwidth        = 1;
+   rs->lastside         = 1;
+   rs->lastintercept    = rs->xtile;
+   rs->lasttilehit      = rs->tilehit;
+   rs->lasttexture      = texture;
+   wallheight[rs->pixx] = CalcHeight(rs);
+   rs->postx            = rs->pixx;
 
    /* check for adjacent doors */
-   if (tilehit & 0x40)
+   if (rs->tilehit & 0x40)
    {                                                               
-      ytile = (short)(yintercept>>TILESHIFT);
+      rs->ytile = (short)(rs->yintercept>>TILESHIFT);
 
-      if ( tilemap[xtile-xtilestep][ytile]&0x80 )
+      if ( tilemap[rs->xtile-rs->xtilestep][rs->ytile]&0x80 )
          wallpic = DOORWALL+3;
       else
-         wallpic = vertwall[tilehit & ~0x40];
+         wallpic = vertwall[rs->tilehit & ~0x40];
    }
    else
-      wallpic = vertwall[tilehit];
+      wallpic = vertwall[rs->tilehit];
 
-   postsource = PM_GetTexture(wallpic) + texture;
+   rs->postsource = PM_GetTexture(wallpic) + texture;
 }
 
 
@@ -370,60 +604,58 @@ static void HitVertWall (void)
 ====================
 */
 
-static void HitHorizWall(void)
+static void HitHorizWall(raystate_t *rs)
 {
    int wallpic;
-   int texture = ((xintercept+texdelta)>>TEXTUREFROMFIXEDSHIFT)&TEXTUREMASK;
+   int texture = ((rs->xintercept+rs->texdelta)>>TEXTUREFROMFIXEDSHIFT)&TEXTUREMASK;
 
-   if (ytilestep == -1)
-      yintercept += TILEGLOBAL;
+   if (rs->ytilestep == -1)
+      rs->yintercept += TILEGLOBAL;
    else
       texture = TEXTUREMASK-texture;
 
-   if (lastside == 0 
-         && lastintercept == ytile
-         && lasttilehit   == tilehit
-         && !(lasttilehit & 0x40))
+   if (rs->lastside == 0 
+         && rs->lastintercept == rs->ytile
+         && rs->lasttilehit   == rs->tilehit
+         && !(rs->lasttilehit & 0x40))
    {
-      ScalePost();
-      if((pixx&3) && texture == lasttexture)
+      ScalePost(rs);
+      if((rs->pixx&3) && texture == rs->lasttexture)
       {
-         postx=pixx;
-         wallheight[pixx] = wallheight[pixx-1];
+         rs->postx=rs->pixx;
+         wallheight[rs->pixx] = wallheight[rs->pixx-1];
          return;
       }
-      wallheight[pixx]    = CalcHeight();
-      postsource         += texture-lasttexture;
-      postwidth           = 1;
-      postx               = pixx;
-      lasttexture         = texture;
+      wallheight[rs->pixx]    = CalcHeight(rs);
+      rs->postsource         += texture-rs->lasttexture;
+      rs->postx               = rs->pixx;
+      rs->lasttexture         = texture;
       return;
    }
 
-   if (lastside != -1)
-      ScalePost();
+   if (rs->lastside != -1)
+      ScalePost(rs);
 
-   lastside               = 0;
-   lastintercept          = ytile;
-   lasttilehit            = tilehit;
-   lasttexture            = texture;
-   wallheight[pixx]       = CalcHeight();
-   postx                  = pixx;
-   postwidth              = 1;
+   rs->lastside               = 0;
+   rs->lastintercept          = rs->ytile;
+   rs->lasttilehit            = rs->tilehit;
+   rs->lasttexture            = texture;
+   wallheight[rs->pixx]       = CalcHeight(rs);
+   rs->postx                  = rs->pixx;
 
    /* check for adjacent doors */
-   if (tilehit & 0x40)
+   if (rs->tilehit & 0x40)
    {
-      xtile = (short)(xintercept>>TILESHIFT);
-      if ( tilemap[xtile][ytile-ytilestep]&0x80)
+      rs->xtile = (short)(rs->xintercept>>TILESHIFT);
+      if ( tilemap[rs->xtile][rs->ytile-rs->ytilestep]&0x80)
          wallpic = DOORWALL+2;
       else
-         wallpic = horizwall[tilehit & ~0x40];
+         wallpic = horizwall[rs->tilehit & ~0x40];
    }
    else
-      wallpic = horizwall[tilehit];
+      wallpic = horizwall[rs->tilehit];
 
-   postsource = PM_GetTexture(wallpic) + texture;
+   rs->postsource = PM_GetTexture(wallpic) + texture;
 }
 
 /*
@@ -434,38 +666,36 @@ static void HitHorizWall(void)
 ====================
 */
 
-static void HitHorizDoor (void)
+static void HitHorizDoor (raystate_t *rs)
 {
    int doorpage;
-   int doornum = tilehit&0x7f;
-   int texture = ((xintercept-doorposition[doornum])>>TEXTUREFROMFIXEDSHIFT)&TEXTUREMASK;
+   int doornum = rs->tilehit&0x7f;
+   int texture = ((rs->xintercept-doorposition[doornum])>>TEXTUREFROMFIXEDSHIFT)&TEXTUREMASK;
 
-   if(lasttilehit==tilehit)
+   if(rs->lastside == 2 && rs->lasttilehit==rs->tilehit)
    {
-      ScalePost();
-      if((pixx&3) && texture == lasttexture)
+      ScalePost(rs);
+      if((rs->pixx&3) && texture == rs->lasttexture)
       {
-         postx            = pixx;
-         wallheight[pixx] = wallheight[pixx-1];
+         rs->postx            = rs->pixx;
+         wallheight[rs->pixx] = wallheight[rs->pixx-1];
          return;
       }
-      wallheight[pixx]  = CalcHeight();
-      postsource       += texture-lasttexture;
-      postwidth         = 1;
-      postx             = pixx;
-      lasttexture       = texture;
+      wallheight[rs->pixx]  = CalcHeight(rs);
+      rs->postsource       += texture-rs->lasttexture;
+      rs->postx             = rs->pixx;
+      rs->lasttexture       = texture;
       return;
    }
 
-   if (lastside != -1)
-      ScalePost();
+   if (rs->lastside != -1)
+      ScalePost(rs);
 
-   lastside         = 2;
-   lasttilehit      = tilehit;
-   lasttexture      = texture;
-   wallheight[pixx] = CalcHeight();
-   postx            = pixx;
-   postwidth        = 1;
+   rs->lastside         = 2;
+   rs->lasttilehit      = rs->tilehit;
+   rs->lasttexture      = texture;
+   wallheight[rs->pixx] = CalcHeight(rs);
+   rs->postx            = rs->pixx;
 
    switch(doorobjlist[doornum].lock)
    {
@@ -483,7 +713,7 @@ static void HitHorizDoor (void)
          break;
    }
 
-   postsource = PM_GetTexture(doorpage) + texture;
+   rs->postsource = PM_GetTexture(doorpage) + texture;
 }
 
 /*
@@ -494,40 +724,38 @@ static void HitHorizDoor (void)
 ====================
 */
 
-static void HitVertDoor (void)
+static void HitVertDoor (raystate_t *rs)
 {
    int doorpage;
-   int doornum = tilehit&0x7f;
-   int texture = ((yintercept - doorposition[doornum]) >> TEXTUREFROMFIXEDSHIFT) & TEXTUREMASK;
+   int doornum = rs->tilehit&0x7f;
+   int texture = ((rs->yintercept - doorposition[doornum]) >> TEXTUREFROMFIXEDSHIFT) & TEXTUREMASK;
 
-   if (lasttilehit == tilehit)
+   if (rs->lastside == 3 && rs->lasttilehit == rs->tilehit)
    {
-      ScalePost();
+      ScalePost(rs);
 
-      if((pixx&3) && texture == lasttexture)
+      if((rs->pixx&3) && texture == rs->lasttexture)
       {
-         postx            = pixx;
-         wallheight[pixx] = wallheight[pixx-1];
+         rs->postx            = rs->pixx;
+         wallheight[rs->pixx] = wallheight[rs->pixx-1];
          return;
       }
 
-      wallheight[pixx]    = CalcHeight();
-      postsource         += texture-lasttexture;
-      postwidth           = 1;
-      postx               = pixx;
-      lasttexture         = texture;
+      wallheight[rs->pixx]    = CalcHeight(rs);
+      rs->postsource         += texture-rs->lasttexture;
+      rs->postx               = rs->pixx;
+      rs->lasttexture         = texture;
       return;
    }
 
-   if (lastside != -1)
-      ScalePost();
+   if (rs->lastside != -1)
+      ScalePost(rs);
 
-   lastside         = 2;
-   lasttilehit      = tilehit;
-   lasttexture      = texture;
-   wallheight[pixx] = CalcHeight();
-   postx            = pixx;
-   postwidth        = 1;
+   rs->lastside         = 3;
+   rs->lasttilehit      = rs->tilehit;
+   rs->lasttexture      = texture;
+   wallheight[rs->pixx] = CalcHeight(rs);
+   rs->postx            = rs->pixx;
 
    switch(doorobjlist[doornum].lock)
    {
@@ -545,7 +773,7 @@ static void HitVertDoor (void)
          break;
    }
 
-   postsource = PM_GetTexture(doorpage) + texture;
+   rs->postsource = PM_GetTexture(doorpage) + texture;
 }
 
 //==========================================================================
@@ -576,11 +804,21 @@ byte vgaCeiling[]=
 
 static void ClearScreen (void)
 {
-   int y;
+   int x, y;
    unsigned int ceiling = vgaCeiling[gamestate.episode*10+mapon] & 0xFF;
    unsigned int floor = 0x19;
    byte *ptr    = vbuf;
 
+   if (vbufColStep != 1)
+   {
+      for(x = 0; x < viewwidth; x++, ptr += vbufColStep)
+      {
+         memset(ptr, ceiling, viewheight / 2);
+         memset(ptr + viewheight / 2, floor, viewheight - viewheight / 2);
+      }
+      return;
+   }
+
    for(y = 0; y < viewheight / 2; y++, ptr += vbufPitch)
       memset(ptr, ceiling, viewwidth);
 
@@ -590,6 +828,130 @@ static void ClearScreen (void)
 
 //==========================================================================
 
+/*
+ * Occlusion pyramid over wallheight. Level 0 is wallheight itself,
+ * entry x of level k holds the lowest wall of columns x<<k up to
+ * (x+1)<<k, so a sprite column range whose entry is higher than the
+ * sprite is hidden behind walls as a whole.
+ */
+#define MAXOCCLUSIONLEVELS 16
+
+static int *occlusionlevel[MAXOCCLUSIONLEVELS];
+static int *occlusionbuffer;
+static int numocclusionlevels;
+static int occlusionwidth;
+
+/*
+=====================
+=
+= BuildOcclusion
+=
+= Called after all posts of the frame are traced
+=
+=====================
+*/
+
+static void BuildOcclusion (void)
+{
+   int k, x, width;
+
+   if (occlusionwidth != viewwidth)
+   {
+      int *next;
+
+      /* the levels above 0 take about viewwidth ints together, each */
+      /* level can have one more than half of the one below it       */
+      free(occlusionbuffer);
+      occlusionbuffer    = (int *) malloc((viewwidth + MAXOCCLUSIONLEVELS) * sizeof(int));
+      CHECKMALLOCRESULT(occlusionbuffer);
+      occlusionwidth     = viewwidth;
+      numocclusionlevels = 1;
+
+      for (width = viewwidth, next = occlusionbuffer;
+            width > 1 && numocclusionlevels < MAXOCCLUSIONLEVELS;
+            numocclusionlevels++)
+      {
+         width = (width + 1) >> 1;
+         occlusionlevel[numocclusionlevels] = next;
+         next += width;
+      }
+   }
+
+   occlusionlevel[0] = wallheight;
+
+   for (k = 1, width = viewwidth; k < numocclusionlevels; k++)
+   {
+      int *below = occlusionlevel[k - 1];
+      int *level = occlusionlevel[k];
+
+      for (x = 0; x < width >> 1; x++)
+         level[x] = below[2 * x] < below[2 * x + 1] ? below[2 * x] : below[2 * x + 1];
+      if (width & 1)
+         level[x] = below[2 * x];
+      width = (width + 1) >> 1;
+   }
+}
+
+/*
+=====================
+=
+= NextVisibleColumn
+=
+= Returns the first column from x up to end where a sprite of the
+= given height is in front of the wall, or end if there is none
+=
+=====================
+*/
+
+static int NextVisibleColumn (int x, int end, int height)
+{
+   int k = 0;
+
+   while (x < end)
+   {
+      if (occlusionlevel[k][x >> k] > height)
+      {
+         /* the whole block is hidden, skip it and climb while aligned */
+         x = ((x >> k) + 1) << k;
+         while (k + 1 < numocclusionlevels && !(x & ((2 << k) - 1)))
+            k++;
+      }
+      else if (!k)
+         return x;
+      else
+         k--;
+   }
+
+   return end;
+}
+
+/*
+=====================
+=
+= SpriteOccluded
+=
+= True when every column a sprite centered on xcenter could cover
+= is behind a wall
+=
+=====================
+*/
+
+static boolean SpriteOccluded (int xcenter, unsigned height)
+{
+   int scale = height >> 3;
+   int left  = xcenter - scale;
+   int right = xcenter + scale;
+
+   if (left < 0)
+      left = 0;
+   if (right > viewwidth)
+      right = viewwidth;
+
+   return NextVisibleColumn(left, right, height) == right;
+}
+
+//==========================================================================
+
 /*
 =====================
 =
@@ -630,19 +992,17 @@ static void ScaleShape (int xcenter, int shapenum, unsigned height, uint32_t fla
 {
    unsigned scale, pixheight;
    unsigned starty,endy;
-   word *cmdptr;
-   byte *cline;
-   byte *line;
+   spriterun_t *firstrun, *lastrun, *run;
+   byte *texels;
    byte *vmem;
    int actx,i,upperedge;
-   short newstart;
    int scrstarty,screndy,lpix,rpix,pixcnt,ycnt;
    unsigned j;
    byte col;
-   t_compshape *shape = (t_compshape *) PM_GetSprite(shapenum);
-   word leftpix       = (word)Retro_SwapLES16(shape->leftpix);
-   word rightpix      = (word)Retro_SwapLES16(shape->rightpix);
-   scale              = height >> 3; /* low three bits are fractional */
+   spriteruns_t *sprite = PM_GetSpriteRuns(shapenum);
+   word leftpix         = sprite->leftpix;
+   word rightpix        = sprite->rightpix;
+   scale                = height >> 3; /* low three bits are fractional */
 
    /* too close or far away? */
    if(!scale)
@@ -652,11 +1012,9 @@ static void ScaleShape (int xcenter, int shapenum, unsigned height, uint32_t fla
    actx               = xcenter-scale;
    upperedge          = viewheight/2-scale;
 
-   cmdptr             = (word *)shape->dataofs;
-
    for(i= leftpix, pixcnt= i * pixheight, rpix = (pixcnt >> 6) + actx;
          i <= rightpix;
-         i++, cmdptr++)
+         i++)
    {
       lpix=rpix;
 
@@ -668,60 +1026,56 @@ static void ScaleShape (int xcenter, int shapenum, unsigned height, uint32_t fla
 
       if(lpix != rpix && rpix > 0)
       {
+         firstrun = sprite->runs + sprite->firstrun[i - leftpix];
+         lastrun  = sprite->runs + sprite->firstrun[i - leftpix + 1];
+
          if(lpix < 0)
             lpix=0;
 
          if(rpix > viewwidth)
             rpix= viewwidth, i = rightpix + 1;
 
-         cline = (byte *)shape + (word)Retro_SwapLES16(*cmdptr);
-
-         while(lpix < rpix)
+         for(lpix = NextVisibleColumn(lpix, rpix, height); lpix < rpix;
+               lpix = NextVisibleColumn(lpix + 1, rpix, height))
          {
-            if(wallheight[lpix] <= (int)height)
+            for(run = firstrun; run < lastrun; run++)
             {
-               line = cline;
+               starty     = run->starty;
+               endy       = run->endy;
+               texels     = sprite->texels + run->pixels;
+               ycnt       = starty * pixheight;
+               screndy    = (ycnt >> 6) + upperedge;
+
+               if(screndy<0)
+                  vmem    = vbuf + lpix * vbufColStep;
+               else
+                  vmem    = vbuf + screndy * vbufPitch + lpix * vbufColStep;
 
-               while((endy = READWORD(&line)) != 0)
+               for(j = starty; j < endy; j++)
                {
-                  endy     >>= 1;
-                  newstart   = READWORD(&line);
-                  starty     = READWORD(&line) >> 1;
-                  ycnt       = starty * pixheight;
-                  screndy    = (ycnt >> 6) + upperedge;
-
-                  if(screndy<0)
-                     vmem    = vbuf+lpix;
-                  else
-                     vmem    = vbuf + screndy * vbufPitch + lpix;
+                  scrstarty  = screndy;
+                  ycnt      += pixheight;
+                  screndy    = (ycnt>>6) + upperedge;
 
-                  for(j = starty; j < endy; j++)
+                  if(scrstarty != screndy && screndy > 0)
                   {
-                     scrstarty  = screndy;
-                     ycnt      += pixheight;
-                     screndy    = (ycnt>>6) + upperedge;
+                     col=texels[j - starty];
 
-                     if(scrstarty != screndy && screndy > 0)
-                     {
-                        col=((byte *)shape)[newstart+j];
-
-                        if(scrstarty < 0)
-                           scrstarty=0;
+                     if(scrstarty < 0)
+                        scrstarty=0;
 
-                        if(screndy > viewheight)
-                           screndy=viewheight,j=endy;
+                     if(screndy > viewheight)
+                        screndy=viewheight,j=endy;
 
-                        while(scrstarty < screndy)
-                        {
-                           *vmem=col;
-                           vmem+=vbufPitch;
-                           scrstarty++;
-                        }
+                     while(scrstarty < screndy)
+                     {
+                        *vmem=col;
+                        vmem+=vbufPitch;
+                        scrstarty++;
                      }
                   }
                }
             }
-            lpix++;
          }
       }
    }
@@ -730,26 +1084,24 @@ static void ScaleShape (int xcenter, int shapenum, unsigned height, uint32_t fla
 static void SimpleScaleShape (int xcenter, int shapenum, unsigned height)
 {
    unsigned starty,endy;
-   byte *cline;
-   byte *line;
+   spriterun_t *firstrun, *lastrun, *run;
+   byte *texels;
    int i;
-   short newstart;
    int scrstarty,screndy,lpix,rpix,pixcnt,ycnt;
    unsigned j;
    byte col;
    byte *vmem;
-   t_compshape *shape = (t_compshape *) PM_GetSprite(shapenum);
-   word leftpix       = (word)Retro_SwapLES16(shape->leftpix);
-   word rightpix      = (word)Retro_SwapLES16(shape->rightpix);
-   unsigned scale     = height >> 1;
-   unsigned pixheight = scale * SPRITESCALEFACTOR;
-   int actx           = xcenter - scale;
-   int upperedge      = viewheight / 2 - scale;
-   word *cmdptr       = shape->dataofs;
+   spriteruns_t *sprite = PM_GetSpriteRuns(shapenum);
+   word leftpix         = sprite->leftpix;
+   word rightpix        = sprite->rightpix;
+   unsigned scale       = height >> 1;
+   unsigned pixheight   = scale * SPRITESCALEFACTOR;
+   int actx             = xcenter - scale;
+   int upperedge        = viewheight / 2 - scale;
 
    for(i = leftpix, pixcnt = i * pixheight, rpix = (pixcnt >> 6) + actx;
          i <= rightpix;
-         i++, cmdptr++)
+         i++)
    {
       lpix      = rpix;
 
@@ -764,28 +1116,28 @@ static void SimpleScaleShape (int xcenter, int shapenum, unsigned height)
       if (rpix <= 0)
          continue;
 
+      firstrun = sprite->runs + sprite->firstrun[i - leftpix];
+      lastrun  = sprite->runs + sprite->firstrun[i - leftpix + 1];
+
       if(lpix < 0)
          lpix = 0;
       if(rpix > viewwidth)
          rpix = viewwidth, i = rightpix + 1;
-      cline   = (byte *)shape + (word)Retro_SwapLES16(*cmdptr);
 
       while(lpix < rpix)
       {
-         line=cline;
-
-         while((endy = READWORD(&line)) != 0)
+         for(run = firstrun; run < lastrun; run++)
          {
-            endy     >>= 1;
-            newstart   = READWORD(&line);
-            starty     = READWORD(&line) >> 1;
+            starty     = run->starty;
+            endy       = run->endy;
+            texels     = sprite->texels + run->pixels;
             ycnt       = starty * pixheight;
             screndy    = (ycnt>>6)+upperedge;
 
             if(screndy<0)
-               vmem    = vbuf+lpix;
+               vmem    = vbuf+lpix*vbufColStep;
             else
-               vmem    = vbuf+screndy*vbufPitch+lpix;
+               vmem    = vbuf+screndy*vbufPitch+lpix*vbufColStep;
 
             for(j = starty; j < endy; j++)
             {
@@ -795,7 +1147,7 @@ static void SimpleScaleShape (int xcenter, int shapenum, unsigned height)
 
                if(scrstarty != screndy && screndy > 0)
                {
-                  col = ((byte *)shape)[newstart+j];
+                  col = texels[j - starty];
 
                   if (scrstarty < 0)
                      scrstarty = 0;
@@ -816,7 +1168,7 @@ static void SimpleScaleShape (int xcenter, int shapenum, unsigned height)
    }
 }
 
-#define MAXVISABLE 250
+#define INITVISABLE 256
 
 typedef struct
 {
@@ -827,8 +1179,85 @@ typedef struct
    short      flags;          
 } visobj_t;
 
-visobj_t vislist[MAXVISABLE];
-visobj_t *visptr,*visstep,*farthest;
+visobj_t *vislist;
+visobj_t *visptr;
+
+static int      maxvisable;
+static visobj_t **vissorted, **vistemp;
+
+/*
+=====================
+=
+= GrowVisList
+=
+= Doubles the visable object list, visptr stays on the same entry
+=
+=====================
+*/
+
+static void GrowVisList (void)
+{
+   int used = vislist ? (int) (visptr - vislist) : 0;
+
+   maxvisable = maxvisable ? maxvisable * 2 : INITVISABLE;
+
+   vislist    = (visobj_t *) realloc(vislist, maxvisable * sizeof(*vislist));
+   CHECKMALLOCRESULT(vislist);
+   vissorted  = (visobj_t **) realloc(vissorted, maxvisable * sizeof(*vissorted));
+   CHECKMALLOCRESULT(vissorted);
+   vistemp    = (visobj_t **) realloc(vistemp, maxvisable * sizeof(*vistemp));
+   CHECKMALLOCRESULT(vistemp);
+
+   visptr     = vislist + used;
+}
+
+/*
+=====================
+=
+= SortVisList
+=
+= Radix sorts the visable objects by viewheight, farthest first.
+= The sort is stable, so objects of equal height are drawn in list order.
+=
+=====================
+*/
+
+static visobj_t **SortVisList (int numvisable)
+{
+   int      i, shift, sum;
+   int      count[256];
+   visobj_t **src = vistemp, **dest = vissorted, **swap;
+
+   for (i = 0; i < numvisable; i++)
+      src[i] = &vislist[i];
+
+   for (shift = 0; shift < 16; shift += 8)
+   {
+      memset(count, 0, sizeof(count));
+      for (i = 0; i < numvisable; i++)
+         count[(((word) src[i]->viewheight ^ 0x8000) >> shift) & 0xff]++;
+
+      /* all in one bucket, nothing to reorder */
+      if (count[(((word) src[0]->viewheight ^ 0x8000) >> shift) & 0xff] == numvisable)
+         continue;
+
+      for (i = 0, sum = 0; i < 256; i++)
+      {
+         int n    = count[i];
+         count[i] = sum;
+         sum     += n;
+      }
+
+      for (i = 0; i < numvisable; i++)
+         dest[count[(((word) src[i]->viewheight ^ 0x8000) >> shift) & 0xff]++] = src[i];
+
+      swap = src;
+      src  = dest;
+      dest = swap;
+   }
+
+   return src;
+}
 
 /*
 =====================
@@ -842,11 +1271,15 @@ visobj_t *visptr,*visstep,*farthest;
 
 static void DrawScaleds (void)
 {
-   int      i,least,numvisable,height;
+   int      i,numvisable;
    byte     *tilespot,*visspot;
    unsigned spotloc;
    statobj_t *statptr;
    objtype   *obj;
+   visobj_t  **sorted;
+
+   if (!vislist)
+      GrowVisList();
 
    visptr = &vislist[0];
 
@@ -875,12 +1308,9 @@ static void DrawScaleds (void)
       if (!visptr->viewheight)
          continue;
 
-      /* don't let it overflow */
-      if (visptr < &vislist[MAXVISABLE-1])
-      {
-         visptr->flags = (short) statptr->flags;
-         visptr++;
-      }
+      visptr->flags = (short) statptr->flags;
+      if (++visptr == &vislist[maxvisable])
+         GrowVisList();
    }
 
    /* place active objects */
@@ -922,13 +1352,10 @@ static void DrawScaleds (void)
          if (obj->state->rotate)
             visptr->shapenum += CalcRotate (obj);
 
-         /* don't let it overflow. */
-         if (visptr < &vislist[MAXVISABLE-1])
-         {
-            visptr->flags = (short) obj->flags;
+         visptr->flags = (short) obj->flags;
+         if (++visptr == &vislist[maxvisable])
+            GrowVisList();
 
-            visptr++;
-         }
          obj->flags |= FL_VISABLE;
       }
       else
@@ -942,24 +1369,16 @@ static void DrawScaleds (void)
    if (!numvisable)
       return;                                                                 
 
+   sorted = SortVisList(numvisable);
+
    for (i = 0; i < numvisable; i++)
    {
-      least = 32000;
-      for (visstep = &vislist[0]; visstep<visptr; visstep++)
-      {
-         height = visstep->viewheight;
-         if (height < least)
-         {
-            least = height;
-            farthest = visstep;
-         }
-      }
-
-      /* draw farthest */
-      ScaleShape(farthest->viewx, farthest->shapenum,
-            farthest->viewheight, farthest->flags);
+      /* completely behind walls? */
+      if (SpriteOccluded(sorted[i]->viewx, sorted[i]->viewheight))
+         continue;
 
-      farthest->viewheight = 32000;
+      ScaleShape(sorted[i]->viewx, sorted[i]->shapenum,
+            sorted[i]->viewheight, sorted[i]->flags);
    }
 }
 
@@ -1023,13 +1442,13 @@ void CalcTics (void)
    if (lasttimecount > (int32_t) GetTimeCount())
       lasttimecount = GetTimeCount();    /* if the game was paused a LONG time */
 
-   curtime = LR_GetTicks();
+   curtime = LR_GetGameTicks();
    tics = (curtime * 7) / 100 - lasttimecount;
 
    if(!tics)
    {
       /* wait until end of current tic */
-      rarch_sleep(((lasttimecount + 1) * 100) / 7 - curtime);
+      LR_Delay(((lasttimecount + 1) * 100) / 7 - curtime);
       tics = 1;
    }
 
@@ -1039,15 +1458,15 @@ void CalcTics (void)
       tics = MAXTICS;
 }
 
-static void AsmRefresh(void)
+static void AsmRefresh(raystate_t *rs, int startx, int endx)
 {
    int32_t xstep,ystep;
    longword xpartial,ypartial;
    boolean playerInPushwallBackTile = tilemap[focaltx][focalty] == 64;
 
-   for(pixx = 0; pixx < viewwidth; pixx++)
+   for(rs->pixx = startx; rs->pixx < endx; rs->pixx++)
    {
-      short angl = midangle+pixelangle[pixx];
+      short angl = midangle+pixelangle[rs->pixx];
       if(angl < 0)
          angl += FINEANGLES;
       if(angl >= 3600)
@@ -1055,8 +1474,8 @@ static void AsmRefresh(void)
 
       if(angl < 900)
       {
-         xtilestep=1;
-         ytilestep=-1;
+         rs->xtilestep=1;
+         rs->ytilestep=-1;
          xstep=finetangent[900-1-angl];
          ystep=-finetangent[angl];
          xpartial=xpartialup;
@@ -1064,8 +1483,8 @@ static void AsmRefresh(void)
       }
       else if(angl < 1800)
       {
-         xtilestep=-1;
-         ytilestep=-1;
+         rs->xtilestep=-1;
+         rs->ytilestep=-1;
          xstep=-finetangent[angl-900];
          ystep=-finetangent[1800-1-angl];
          xpartial=xpartialdown;
@@ -1073,8 +1492,8 @@ static void AsmRefresh(void)
       }
       else if(angl < 2700)
       {
-         xtilestep= -1;
-         ytilestep=  1;
+         rs->xtilestep= -1;
+         rs->ytilestep=  1;
          xstep    = -finetangent[2700-1-angl];
          ystep    = finetangent[angl-1800];
          xpartial = xpartialdown;
@@ -1082,60 +1501,60 @@ static void AsmRefresh(void)
       }
       else if(angl < 3600)
       {
-         xtilestep= 1;
-         ytilestep= 1;
+         rs->xtilestep= 1;
+         rs->ytilestep= 1;
          xstep    = finetangent[angl-2700];
          ystep    = finetangent[3600-1-angl];
          xpartial = xpartialup;
          ypartial = ypartialup;
       }
 
-      yintercept  = FixedMul(ystep,xpartial)+viewy;
-      xtile       = focaltx+xtilestep;
-      xspot       = (word)((xtile<<mapshift)+((uint32_t)yintercept>>16));
-      xintercept  = FixedMul(xstep,ypartial)+viewx;
-      ytile       = focalty+ytilestep;
-      yspot       = (word)((((uint32_t)xintercept>>16)<<mapshift)+ytile);
-      texdelta    = 0;
+      rs->yintercept  = FixedMul(ystep,xpartial)+viewy;
+      rs->xtile       = focaltx+rs->xtilestep;
+      rs->xspot       = (word)((rs->xtile<<mapshift)+((uint32_t)rs->yintercept>>16));
+      rs->xintercept  = FixedMul(xstep,ypartial)+viewx;
+      rs->ytile       = focalty+rs->ytilestep;
+      rs->yspot       = (word)((((uint32_t)rs->xintercept>>16)<<mapshift)+rs->ytile);
+      rs->texdelta    = 0;
 
       /* Special treatment when player is in back tile of pushwall */
       if(playerInPushwallBackTile)
       {
-         if(    pwalldir == DI_EAST && xtilestep ==  1
-               || pwalldir == DI_WEST && xtilestep == -1)
+         if(    pwalldir == DI_EAST && rs->xtilestep ==  1
+               || pwalldir == DI_WEST && rs->xtilestep == -1)
          {
-            int32_t yintbuf = yintercept - ((ystep * (64 - pwallpos)) >> 6);
+            int32_t yintbuf = rs->yintercept - ((ystep * (64 - pwallpos)) >> 6);
 
             /* ray hits pushwall back? */
             if((yintbuf >> 16) == focalty)
             {
                if(pwalldir == DI_EAST)
-                  xintercept = (focaltx << TILESHIFT) + (pwallpos << 10);
+                  rs->xintercept = (focaltx << TILESHIFT) + (pwallpos << 10);
                else
-                  xintercept = (focaltx << TILESHIFT) - TILEGLOBAL + ((64 - pwallpos) << 10);
-               yintercept = yintbuf;
-               ytile = (short) (yintercept >> TILESHIFT);
-               tilehit = pwalltile;
-               HitVertWall();
+                  rs->xintercept = (focaltx << TILESHIFT) - TILEGLOBAL + ((64 - pwallpos) << 10);
+               rs->yintercept = yintbuf;
+               rs->ytile = (short) (rs->yintercept >> TILESHIFT);
+               rs->tilehit = pwalltile;
+               HitVertWall(rs);
                continue;
             }
          }
-         else if(pwalldir == DI_SOUTH && ytilestep ==  1
-               ||  pwalldir == DI_NORTH && ytilestep == -1)
+         else if(pwalldir == DI_SOUTH && rs->ytilestep ==  1
+               ||  pwalldir == DI_NORTH && rs->ytilestep == -1)
          {
-            int32_t xintbuf = xintercept - ((xstep * (64 - pwallpos)) >> 6);
+            int32_t xintbuf = rs->xintercept - ((xstep * (64 - pwallpos)) >> 6);
 
             /* ray hits pushwall back? */
             if((xintbuf >> 16) == focaltx)
             {
-               xintercept = xintbuf;
+               rs->xintercept = xintbuf;
                if(pwalldir == DI_SOUTH)
-                  yintercept = (focalty << TILESHIFT) + (pwallpos << 10);
+                  rs->yintercept = (focalty << TILESHIFT) + (pwallpos << 10);
                else
-                  yintercept = (focalty << TILESHIFT) - TILEGLOBAL + ((64 - pwallpos) << 10);
-               xtile = (short) (xintercept >> TILESHIFT);
-               tilehit = pwalltile;
-               HitHorizWall();
+                  rs->yintercept = (focalty << TILESHIFT) - TILEGLOBAL + ((64 - pwallpos) << 10);
+               rs->xtile = (short) (rs->xintercept >> TILESHIFT);
+               rs->tilehit = pwalltile;
+               HitHorizWall(rs);
                continue;
             }
          }
@@ -1143,53 +1562,53 @@ static void AsmRefresh(void)
 
       do
       {
-         if(ytilestep==-1 && (yintercept>>16)<=ytile)
+         if(rs->ytilestep==-1 && (rs->yintercept>>16)<=rs->ytile)
             goto horizentry;
-         if(ytilestep==1 && (yintercept>>16)>=ytile)
+         if(rs->ytilestep==1 && (rs->yintercept>>16)>=rs->ytile)
             goto horizentry;
 vertentry:
-         if((uint32_t)yintercept>mapheight*65536-1 || (word)xtile>=mapwidth)
+         if((uint32_t)rs->yintercept>mapheight*65536-1 || (word)rs->xtile>=mapwidth)
          {
-            if (xtile<0)
-               xintercept=0, xtile=0;
-            else if(xtile>=mapwidth)
-               xintercept=mapwidth<<TILESHIFT, xtile=mapwidth-1;
+            if (rs->xtile<0)
+               rs->xintercept=0, rs->xtile=0;
+            else if(rs->xtile>=mapwidth)
+               rs->xintercept=mapwidth<<TILESHIFT, rs->xtile=mapwidth-1;
             else
-               xtile=(short) (xintercept >> TILESHIFT);
+               rs->xtile=(short) (rs->xintercept >> TILESHIFT);
 
-            if(yintercept<0)
-               yintercept=0, ytile=0;
-            else if(yintercept>=(mapheight<<TILESHIFT))
-               yintercept=mapheight<<TILESHIFT, ytile=mapheight-1;
+            if(rs->yintercept<0)
+               rs->yintercept=0, rs->ytile=0;
+            else if(rs->yintercept>=(mapheight<<TILESHIFT))
+               rs->yintercept=mapheight<<TILESHIFT, rs->ytile=mapheight-1;
 
-            yspot=0xffff;
-            tilehit=0;
-            HitHorizWall();
+            rs->yspot=0xffff;
+            rs->tilehit=0;
+            HitHorizWall(rs);
             break;
          }
 
-         if(xspot>=maparea)
+         if(rs->xspot>=maparea)
             break;
 
-         tilehit=((byte *)tilemap)[xspot];
+         rs->tilehit=((byte *)tilemap)[rs->xspot];
 
-         if(tilehit)
+         if(rs->tilehit)
          {
-            if(tilehit & 0x80)
+            if(rs->tilehit & 0x80)
             {
-               int32_t yintbuf=yintercept+(ystep>>1);
-               if((yintbuf>>16)!=(yintercept>>16))
+               int32_t yintbuf=rs->yintercept+(ystep>>1);
+               if((yintbuf>>16)!=(rs->yintercept>>16))
                   goto passvert;
-               if((word)yintbuf<doorposition[tilehit&0x7f])
+               if((word)yintbuf<doorposition[rs->tilehit&0x7f])
                   goto passvert;
-               yintercept=yintbuf;
-               xintercept=(xtile<<TILESHIFT)|0x8000;
-               ytile = (short) (yintercept >> TILESHIFT);
-               HitVertDoor();
+               rs->yintercept=yintbuf;
+               rs->xintercept=(rs->xtile<<TILESHIFT)|0x8000;
+               rs->ytile = (short) (rs->yintercept >> TILESHIFT);
+               HitVertDoor(rs);
             }
             else
             {
-               if(tilehit == 64)
+               if(rs->tilehit == 64)
                {
                   if(pwalldir == DI_WEST || pwalldir == DI_EAST)
                   {
@@ -1203,28 +1622,28 @@ vertentry:
                         pwallposinv = pwallpos;
                      }
 
-                     if(pwalldir == DI_EAST && xtile==pwallx && ((uint32_t)yintercept>>16)==pwally
-                           || pwalldir == DI_WEST && !(xtile==pwallx && ((uint32_t)yintercept>>16)==pwally))
+                     if(pwalldir == DI_EAST && rs->xtile==pwallx && ((uint32_t)rs->yintercept>>16)==pwally
+                           || pwalldir == DI_WEST && !(rs->xtile==pwallx && ((uint32_t)rs->yintercept>>16)==pwally))
                      {
-                        yintbuf=yintercept+((ystep*pwallposnorm)>>6);
-                        if((yintbuf>>16) != (yintercept>>16))
+                        yintbuf=rs->yintercept+((ystep*pwallposnorm)>>6);
+                        if((yintbuf>>16) != (rs->yintercept>>16))
                            goto passvert;
 
-                        xintercept=(xtile<<TILESHIFT)+TILEGLOBAL-(pwallposinv<<10);
+                        rs->xintercept=(rs->xtile<<TILESHIFT)+TILEGLOBAL-(pwallposinv<<10);
                      }
                      else
                      {
-                        yintbuf=yintercept+((ystep*pwallposinv)>>6);
-                        if((yintbuf>>16)!=(yintercept>>16))
+                        yintbuf=rs->yintercept+((ystep*pwallposinv)>>6);
+                        if((yintbuf>>16)!=(rs->yintercept>>16))
                            goto passvert;
 
-                        xintercept=(xtile<<TILESHIFT)-(pwallposinv<<10);
+                        rs->xintercept=(rs->xtile<<TILESHIFT)-(pwallposinv<<10);
                      }
 
-                     yintercept=yintbuf;
-                     ytile = (short) (yintercept >> TILESHIFT);
-                     tilehit = pwalltile;
-                     HitVertWall();
+                     rs->yintercept=yintbuf;
+                     rs->ytile = (short) (rs->yintercept >> TILESHIFT);
+                     rs->tilehit = pwalltile;
+                     HitVertWall(rs);
                   }
                   else
                   {
@@ -1233,125 +1652,125 @@ vertentry:
                      if(pwalldir == DI_NORTH)
                         pwallposi = 64-pwallpos;
 
-                     if(pwalldir == DI_SOUTH && (word)yintercept<(pwallposi<<10)
-                           || pwalldir == DI_NORTH && (word)yintercept>(pwallposi<<10))
+                     if(pwalldir == DI_SOUTH && (word)rs->yintercept<(pwallposi<<10)
+                           || pwalldir == DI_NORTH && (word)rs->yintercept>(pwallposi<<10))
                      {
-                        if(((uint32_t)yintercept>>16)==pwally && xtile==pwallx)
+                        if(((uint32_t)rs->yintercept>>16)==pwally && rs->xtile==pwallx)
                         {
-                           if(pwalldir == DI_SOUTH && (int32_t)((word)yintercept)+ystep<(pwallposi<<10)
-                                 || pwalldir == DI_NORTH && (int32_t)((word)yintercept)+ystep>(pwallposi<<10))
+                           if(pwalldir == DI_SOUTH && (int32_t)((word)rs->yintercept)+ystep<(pwallposi<<10)
+                                 || pwalldir == DI_NORTH && (int32_t)((word)rs->yintercept)+ystep>(pwallposi<<10))
                               goto passvert;
 
                            if(pwalldir == DI_SOUTH)
-                              yintercept=(yintercept&0xffff0000)+(pwallposi<<10);
+                              rs->yintercept=(rs->yintercept&0xffff0000)+(pwallposi<<10);
                            else
-                              yintercept=(yintercept&0xffff0000)-TILEGLOBAL+(pwallposi<<10);
-                           xintercept=xintercept-((xstep*(64-pwallpos))>>6);
-                           xtile = (short) (xintercept >> TILESHIFT);
-                           tilehit=pwalltile;
-                           HitHorizWall();
+                              rs->yintercept=(rs->yintercept&0xffff0000)-TILEGLOBAL+(pwallposi<<10);
+                           rs->xintercept=rs->xintercept-((xstep*(64-pwallpos))>>6);
+                           rs->xtile = (short) (rs->xintercept >> TILESHIFT);
+                           rs->tilehit=pwalltile;
+                           HitHorizWall(rs);
                         }
                         else
                         {
-                           texdelta = -(pwallposi<<10);
-                           xintercept=xtile<<TILESHIFT;
-                           ytile = (short) (yintercept >> TILESHIFT);
-                           tilehit=pwalltile;
-                           HitVertWall();
+                           rs->texdelta = -(pwallposi<<10);
+                           rs->xintercept=rs->xtile<<TILESHIFT;
+                           rs->ytile = (short) (rs->yintercept >> TILESHIFT);
+                           rs->tilehit=pwalltile;
+                           HitVertWall(rs);
                         }
                      }
                      else
                      {
-                        if(((uint32_t)yintercept>>16)==pwally && xtile==pwallx)
+                        if(((uint32_t)rs->yintercept>>16)==pwally && rs->xtile==pwallx)
                         {
-                           texdelta = -(pwallposi<<10);
-                           xintercept=xtile<<TILESHIFT;
-                           ytile = (short) (yintercept >> TILESHIFT);
-                           tilehit=pwalltile;
-                           HitVertWall();
+                           rs->texdelta = -(pwallposi<<10);
+                           rs->xintercept=rs->xtile<<TILESHIFT;
+                           rs->ytile = (short) (rs->yintercept >> TILESHIFT);
+                           rs->tilehit=pwalltile;
+                           HitVertWall(rs);
                         }
                         else
                         {
-                           if(pwalldir==DI_SOUTH && (int32_t)((word)yintercept)+ystep>(pwallposi<<10)
-                                 || pwalldir==DI_NORTH && (int32_t)((word)yintercept)+ystep<(pwallposi<<10))
+                           if(pwalldir==DI_SOUTH && (int32_t)((word)rs->yintercept)+ystep>(pwallposi<<10)
+                                 || pwalldir==DI_NORTH && (int32_t)((word)rs->yintercept)+ystep<(pwallposi<<10))
                               goto passvert;
 
                            if(pwalldir==DI_SOUTH)
-                              yintercept = (yintercept&0xffff0000)-((64-pwallpos)<<10);
+                              rs->yintercept = (rs->yintercept&0xffff0000)-((64-pwallpos)<<10);
                            else
-                              yintercept = (yintercept&0xffff0000)+((64-pwallpos)<<10);
-                           xintercept    =  xintercept-((xstep*pwallpos)>>6);
-                           xtile         = (short) (xintercept >> TILESHIFT);
-                           tilehit       = pwalltile;
-                           HitHorizWall();
+                              rs->yintercept = (rs->yintercept&0xffff0000)+((64-pwallpos)<<10);
+                           rs->xintercept    =  rs->xintercept-((xstep*pwallpos)>>6);
+                           rs->xtile         = (short) (rs->xintercept >> TILESHIFT);
+                           rs->tilehit       = pwalltile;
+                           HitHorizWall(rs);
                         }
                      }
                   }
                }
                else
                {
-                  xintercept = xtile<<TILESHIFT;
-                  ytile      = (short) (yintercept >> TILESHIFT);
-                  HitVertWall();
+                  rs->xintercept = rs->xtile<<TILESHIFT;
+                  rs->ytile      = (short) (rs->yintercept >> TILESHIFT);
+                  HitVertWall(rs);
                }
             }
             break;
          }
 passvert:
-         *((byte *)spotvis+xspot)=1;
-         xtile+=xtilestep;
-         yintercept+=ystep;
-         xspot=(word)((xtile<<mapshift)+((uint32_t)yintercept>>16));
+         *((byte *)spotvis+rs->xspot)=1;
+         rs->xtile+=rs->xtilestep;
+         rs->yintercept+=ystep;
+         rs->xspot=(word)((rs->xtile<<mapshift)+((uint32_t)rs->yintercept>>16));
       }while(1);
       continue;
 
       do
       {
-         if(xtilestep==-1 && (xintercept>>16)<=xtile)
+         if(rs->xtilestep==-1 && (rs->xintercept>>16)<=rs->xtile)
             goto vertentry;
-         if(xtilestep==1 && (xintercept>>16)>=xtile)
+         if(rs->xtilestep==1 && (rs->xintercept>>16)>=rs->xtile)
             goto vertentry;
 horizentry:
-         if((uint32_t)xintercept>mapwidth*65536-1 || (word)ytile>=mapheight)
+         if((uint32_t)rs->xintercept>mapwidth*65536-1 || (word)rs->ytile>=mapheight)
          {
-            if (ytile<0)
-               yintercept=0, ytile=0;
-            else if(ytile >= mapheight)
-               yintercept = mapheight<<TILESHIFT, ytile=mapheight-1;
+            if (rs->ytile<0)
+               rs->yintercept=0, rs->ytile=0;
+            else if(rs->ytile >= mapheight)
+               rs->yintercept = mapheight<<TILESHIFT, rs->ytile=mapheight-1;
             else
-               ytile=(short) (yintercept >> TILESHIFT);
-
-            if(xintercept<0)
-               xintercept=0, xtile=0;
-            else if(xintercept>=(mapwidth<<TILESHIFT))
-               xintercept=mapwidth<<TILESHIFT, xtile=mapwidth-1;
-            xspot=0xffff;
-            tilehit=0;
-            HitVertWall();
+               rs->ytile=(short) (rs->yintercept >> TILESHIFT);
+
+            if(rs->xintercept<0)
+               rs->xintercept=0, rs->xtile=0;
+            else if(rs->xintercept>=(mapwidth<<TILESHIFT))
+               rs->xintercept=mapwidth<<TILESHIFT, rs->xtile=mapwidth-1;
+            rs->xspot=0xffff;
+            rs->tilehit=0;
+            HitVertWall(rs);
             break;
          }
 
-         if(yspot>=maparea)
+         if(rs->yspot>=maparea)
             break;
-         tilehit=((byte *)tilemap)[yspot];
+         rs->tilehit=((byte *)tilemap)[rs->yspot];
 
-         if(tilehit)
+         if(rs->tilehit)
          {
-            if(tilehit&0x80)
+            if(rs->tilehit&0x80)
             {
-               int32_t xintbuf=xintercept+(xstep>>1);
-               if((xintbuf>>16)!=(xintercept>>16))
+               int32_t xintbuf=rs->xintercept+(xstep>>1);
+               if((xintbuf>>16)!=(rs->xintercept>>16))
                   goto passhoriz;
-               if((word)xintbuf<doorposition[tilehit&0x7f])
+               if((word)xintbuf<doorposition[rs->tilehit&0x7f])
                   goto passhoriz;
-               xintercept=xintbuf;
-               yintercept=(ytile<<TILESHIFT)+0x8000;
-               xtile = (short) (xintercept >> TILESHIFT);
-               HitHorizDoor();
+               rs->xintercept=xintbuf;
+               rs->yintercept=(rs->ytile<<TILESHIFT)+0x8000;
+               rs->xtile = (short) (rs->xintercept >> TILESHIFT);
+               HitHorizDoor(rs);
             }
             else
             {
-               if(tilehit==64)
+               if(rs->tilehit==64)
                {
                   if(pwalldir==DI_NORTH || pwalldir==DI_SOUTH)
                   {
@@ -1365,108 +1784,274 @@ horizentry:
                         pwallposinv = pwallpos;
                      }
 
-                     if(pwalldir == DI_SOUTH && ytile==pwally && ((uint32_t)xintercept>>16)==pwallx
-                           || pwalldir == DI_NORTH && !(ytile==pwally && ((uint32_t)xintercept>>16)==pwallx))
+                     if(pwalldir == DI_SOUTH && rs->ytile==pwally && ((uint32_t)rs->xintercept>>16)==pwallx
+                           || pwalldir == DI_NORTH && !(rs->ytile==pwally && ((uint32_t)rs->xintercept>>16)==pwallx))
                      {
-                        xintbuf=xintercept+((xstep*pwallposnorm)>>6);
-                        if((xintbuf>>16)!=(xintercept>>16))
+                        xintbuf=rs->xintercept+((xstep*pwallposnorm)>>6);
+                        if((xintbuf>>16)!=(rs->xintercept>>16))
                            goto passhoriz;
 
-                        yintercept=(ytile<<TILESHIFT)+TILEGLOBAL-(pwallposinv<<10);
+                        rs->yintercept=(rs->ytile<<TILESHIFT)+TILEGLOBAL-(pwallposinv<<10);
                      }
                      else
                      {
-                        xintbuf=xintercept+((xstep*pwallposinv)>>6);
-                        if((xintbuf>>16)!=(xintercept>>16))
+                        xintbuf=rs->xintercept+((xstep*pwallposinv)>>6);
+                        if((xintbuf>>16)!=(rs->xintercept>>16))
                            goto passhoriz;
 
-                        yintercept=(ytile<<TILESHIFT)-(pwallposinv<<10);
+                        rs->yintercept=(rs->ytile<<TILESHIFT)-(pwallposinv<<10);
                      }
 
-                     xintercept=xintbuf;
-                     xtile = (short) (xintercept >> TILESHIFT);
-                     tilehit=pwalltile;
-                     HitHorizWall();
+                     rs->xintercept=xintbuf;
+                     rs->xtile = (short) (rs->xintercept >> TILESHIFT);
+                     rs->tilehit=pwalltile;
+                     HitHorizWall(rs);
                   }
                   else
                   {
                      int pwallposi = pwallpos;
                      if(pwalldir == DI_WEST)
                         pwallposi = 64-pwallpos;
-                     if(pwalldir == DI_EAST && (word)xintercept<(pwallposi<<10)
-                           || pwalldir == DI_WEST && (word)xintercept>(pwallposi<<10))
+                     if(pwalldir == DI_EAST && (word)rs->xintercept<(pwallposi<<10)
+                           || pwalldir == DI_WEST && (word)rs->xintercept>(pwallposi<<10))
                      {
-                        if(((uint32_t)xintercept>>16)==pwallx && ytile==pwally)
+                        if(((uint32_t)rs->xintercept>>16)==pwallx && rs->ytile==pwally)
                         {
-                           if(pwalldir==DI_EAST && (int32_t)((word)xintercept)+xstep<(pwallposi<<10)
-                                 || pwalldir==DI_WEST && (int32_t)((word)xintercept)+xstep>(pwallposi<<10))
+                           if(pwalldir==DI_EAST && (int32_t)((word)rs->xintercept)+xstep<(pwallposi<<10)
+                                 || pwalldir==DI_WEST && (int32_t)((word)rs->xintercept)+xstep>(pwallposi<<10))
                               goto passhoriz;
 
                            if(pwalldir==DI_EAST)
-                              xintercept=(xintercept&0xffff0000)+(pwallposi<<10);
+                              rs->xintercept=(rs->xintercept&0xffff0000)+(pwallposi<<10);
                            else
-                              xintercept=(xintercept&0xffff0000)-TILEGLOBAL+(pwallposi<<10);
-                           yintercept=yintercept-((ystep*(64-pwallpos))>>6);
-                           ytile = (short) (yintercept >> TILESHIFT);
-                           tilehit=pwalltile;
-                           HitVertWall();
+                              rs->xintercept=(rs->xintercept&0xffff0000)-TILEGLOBAL+(pwallposi<<10);
+                           rs->yintercept=rs->yintercept-((ystep*(64-pwallpos))>>6);
+                           rs->ytile = (short) (rs->yintercept >> TILESHIFT);
+                           rs->tilehit=pwalltile;
+                           HitVertWall(rs);
                         }
                         else
                         {
-                           texdelta = -(pwallposi<<10);
-                           yintercept=ytile<<TILESHIFT;
-                           xtile = (short) (xintercept >> TILESHIFT);
-                           tilehit=pwalltile;
-                           HitHorizWall();
+                           rs->texdelta = -(pwallposi<<10);
+                           rs->yintercept=rs->ytile<<TILESHIFT;
+                           rs->xtile = (short) (rs->xintercept >> TILESHIFT);
+                           rs->tilehit=pwalltile;
+                           HitHorizWall(rs);
                         }
                      }
                      else
                      {
-                        if(((uint32_t)xintercept>>16)==pwallx && ytile==pwally)
+                        if(((uint32_t)rs->xintercept>>16)==pwallx && rs->ytile==pwally)
                         {
-                           texdelta = -(pwallposi<<10);
-                           yintercept=ytile<<TILESHIFT;
-                           xtile = (short) (xintercept >> TILESHIFT);
-                           tilehit=pwalltile;
-                           HitHorizWall();
+                           rs->texdelta = -(pwallposi<<10);
+                           rs->yintercept=rs->ytile<<TILESHIFT;
+                           rs->xtile = (short) (rs->xintercept >> TILESHIFT);
+                           rs->tilehit=pwalltile;
+                           HitHorizWall(rs);
                         }
                         else
                         {
-                           if(pwalldir==DI_EAST && (int32_t)((word)xintercept)+xstep>(pwallposi<<10)
-                                 || pwalldir==DI_WEST && (int32_t)((word)xintercept)+xstep<(pwallposi<<10))
+                           if(pwalldir==DI_EAST && (int32_t)((word)rs->xintercept)+xstep>(pwallposi<<10)
+                                 || pwalldir==DI_WEST && (int32_t)((word)rs->xintercept)+xstep<(pwallposi<<10))
                               goto passhoriz;
 
                            if(pwalldir==DI_EAST)
-                              xintercept=(xintercept&0xffff0000)-((64-pwallpos)<<10);
+                              rs->xintercept=(rs->xintercept&0xffff0000)-((64-pwallpos)<<10);
                            else
-                              xintercept=(xintercept&0xffff0000)+((64-pwallpos)<<10);
-                           yintercept=yintercept-((ystep*pwallpos)>>6);
-                           ytile = (short) (yintercept >> TILESHIFT);
-                           tilehit=pwalltile;
-                           HitVertWall();
+                              rs->xintercept=(rs->xintercept&0xffff0000)+((64-pwallpos)<<10);
+                           rs->yintercept=rs->yintercept-((ystep*pwallpos)>>6);
+                           rs->ytile = (short) (rs->yintercept >> TILESHIFT);
+                           rs->tilehit=pwalltile;
+                           HitVertWall(rs);
                         }
                      }
                   }
                }
                else
                {
-                  yintercept=ytile<<TILESHIFT;
-                  xtile = (short) (xintercept >> TILESHIFT);
-                  HitHorizWall();
+                  rs->yintercept=rs->ytile<<TILESHIFT;
+                  rs->xtile = (short) (rs->xintercept >> TILESHIFT);
+                  HitHorizWall(rs);
                }
             }
             break;
          }
 passhoriz:
-         *((byte *)spotvis+yspot)=1;
-         ytile+=ytilestep;
-         xintercept+=xstep;
-         yspot=(word)((((uint32_t)xintercept>>16)<<mapshift)+ytile);
+         *((byte *)spotvis+rs->yspot)=1;
+         rs->ytile+=rs->ytilestep;
+         rs->xintercept+=xstep;
+         rs->yspot=(word)((((uint32_t)rs->xintercept>>16)<<mapshift)+rs->ytile);
       }
       while(1);
    }
 }
 
+/*
+====================
+=
+= TraceBand
+=
+= Casts the rays of columns startx..endx-1 with their own ray state.
+= Bands must start on a multiple of four, so the (pixx&3) wall height
+= shortcut in the Hit* routines never looks across a band boundary and
+= the result is identical to tracing the whole view in one go.
+=
+====================
+*/
+
+static void TraceBand(raystate_t *rs, int startx, int endx)
+{
+   rs->min_wallheight  = viewheight;
+   rs->numscalermisses = 0;
+   rs->lastside        = -1;       /* the first pixel is on a new wall */
+   AsmRefresh (rs, startx, endx);
+
+   if(rs->lastside != -1)
+      ScalePost (rs);              /* no more optimization on last post */
+}
+
+#ifdef HAVE_THREADS
+
+/* render threads, the main thread always traces band 0 */
+#define MAXREFRESHTHREADS 16
+
+static sthread_t  *refreshthreads[MAXREFRESHTHREADS];
+static raystate_t  refreshstates[MAXREFRESHTHREADS];
+static int         numrefreshbands;
+static slock_t    *refreshlock;
+static scond_t    *refreshstart, *refreshdone;
+static unsigned    refreshframe;
+static int         refreshbusy;
+static boolean     refreshquit;
+static boolean     refreshfailed;
+static char        refresherror[256];    /* the first Quit of a render thread */
+
+static int BandStart(int band)
+{
+   if(band == numrefreshbands)
+      return viewwidth;
+   return (viewwidth * band / numrefreshbands) & ~3;
+}
+
+static void RefreshBand(void *data)
+{
+   int band = (int)(intptr_t)data;
+
+   TraceBand(&refreshstates[band], BandStart(band), BandStart(band + 1));
+}
+
+/*
+ * A Quit while tracing a band only ends the band, WallRefresh quits on the
+ * game thread once all bands are done.
+ */
+static void RefreshThread(void *data)
+{
+   unsigned lastframe = 0;
+   int      failed;
+   char     error[256];
+
+   LR_TraceThreadName("refresh");
+
+   slock_lock(refreshlock);
+   for(;;)
+   {
+      while(refreshframe == lastframe && !refreshquit)
+         scond_wait(refreshstart, refreshlock);
+      if(refreshquit)
+         break;
+      lastframe = refreshframe;
+      slock_unlock(refreshlock);
+
+      LR_TRACE_BEGIN("band");
+      failed = LR_TaskCatch(RefreshBand, data, error, sizeof(error));
+      LR_TRACE_END("band");
+
+      slock_lock(refreshlock);
+      if(failed && !refreshfailed)
+      {
+         strcpy(refresherror, error);
+         refreshfailed = true;
+      }
+      if(--refreshbusy == 0)
+         scond_signal(refreshdone);
+   }
+   slock_unlock(refreshlock);
+}
+
+static void StartRefreshThreads(void)
+{
+   int i;
+   int numbands = param_renderthreads;
+
+   if(numbands > MAXREFRESHTHREADS)
+      numbands = MAXREFRESHTHREADS;
+
+   refreshlock  = slock_new();
+   refreshstart = scond_new();
+   refreshdone  = scond_new();
+   if(!refreshlock || !refreshstart || !refreshdone)
+      goto fail;
+
+   refreshquit   = false;
+   refreshfailed = false;
+   refreshframe  = 0;
+
+   for(i = 1; i < numbands; i++)
+   {
+      refreshthreads[i] = sthread_create(RefreshThread, (void *)(intptr_t)i);
+      if(!refreshthreads[i])
+         goto fail;
+   }
+
+   numrefreshbands = numbands;
+   return;
+
+fail:
+   /* trace serially and don't try again */
+   ShutdownRefreshThreads();
+   numrefreshbands = 1;
+}
+
+#endif
+
+/*
+=====================
+=
+= ShutdownRefreshThreads
+=
+=====================
+*/
+
+void ShutdownRefreshThreads(void)
+{
+#ifdef HAVE_THREADS
+   int i;
+
+   if(refreshlock)
+   {
+      slock_lock(refreshlock);
+      refreshquit = true;
+      scond_broadcast(refreshstart);
+      slock_unlock(refreshlock);
+   }
+
+   for(i = 1; i < MAXREFRESHTHREADS; i++)
+   {
+      if(refreshthreads[i])
+         sthread_join(refreshthreads[i]);
+      refreshthreads[i] = NULL;
+   }
+
+   scond_free(refreshdone);
+   scond_free(refreshstart);
+   slock_free(refreshlock);
+   refreshdone     = NULL;
+   refreshstart    = NULL;
+   refreshlock     = NULL;
+   numrefreshbands = 0;
+#endif
+}
+
 /*
 ====================
 =
@@ -1477,15 +2062,57 @@ passhoriz:
 
 static void WallRefresh(void)
 {
+   raystate_t rs;
+
    xpartialdown = viewx&(TILEGLOBAL-1);
    xpartialup = TILEGLOBAL-xpartialdown;
    ypartialdown = viewy&(TILEGLOBAL-1);
    ypartialup = TILEGLOBAL-ypartialdown;
 
-   min_wallheight = viewheight;
-   lastside = -1;                  /* the first pixel is on a new wall */
-   AsmRefresh ();
-   ScalePost ();                   /* no more optimization on last post */
+   SetupScalers();
+
+#ifdef HAVE_THREADS
+   if(param_renderthreads > 1 && !numrefreshbands)
+      StartRefreshThreads();
+
+   if(numrefreshbands > 1)
+   {
+      int i;
+
+      slock_lock(refreshlock);
+      refreshbusy = numrefreshbands - 1;
+      refreshframe++;
+      scond_broadcast(refreshstart);
+      slock_unlock(refreshlock);
+
+      LR_TRACE_BEGIN("band");
+      TraceBand(&refreshstates[0], 0, BandStart(1));
+      LR_TRACE_END("band");
+
+      slock_lock(refreshlock);
+      while(refreshbusy)
+         scond_wait(refreshdone, refreshlock);
+      slock_unlock(refreshlock);
+
+      if(refreshfailed)
+         Quit("%s", refresherror);
+
+      min_wallheight = refreshstates[0].min_wallheight;
+      for(i = 0; i < numrefreshbands; i++)
+      {
+         if(refreshstates[i].min_wallheight < min_wallheight)
+            min_wallheight = refreshstates[i].min_wallheight;
+         BuildMissedScalers(&refreshstates[i]);
+      }
+      BuildOcclusion();
+      return;
+   }
+#endif
+
+   TraceBand(&rs, 0, viewwidth);
+   min_wallheight = rs.min_wallheight;
+   BuildMissedScalers(&rs);
+   BuildOcclusion();
 }
 
 static void CalcViewVariables(void)
@@ -1514,43 +2141,393 @@ static void CalcViewVariables(void)
    viewty    = (short)(player->y >> TILESHIFT);
 }
 
+/*
+========================
+=
+= GetViewColumns
+=
+= Returns the column major view buffer, grown to fit the current view
+=
+========================
+*/
+
+static byte *GetViewColumns(void)
+{
+   unsigned size = viewwidth * viewheight;
+
+   if (size > viewcolumnssize)
+   {
+      free(viewcolumns);
+      viewcolumns     = (byte *) malloc(size);
+      CHECKMALLOCRESULT(viewcolumns);
+      viewcolumnssize = size;
+   }
+
+   return viewcolumns;
+}
+
+/*
+========================
+=
+= TransposeView
+=
+= Copies the column major view into screenBuffer,
+= in tiles small enough for both sides to stay in cache
+=
+========================
+*/
+
+#define TRANSPOSEBLOCK 32
+
+static void TransposeView(void)
+{
+   int bx, by, x, y, xend, yend;
+   byte *dest = VL_LockSurface(screenBuffer) + screenofs;
+
+   for (bx = 0; bx < viewwidth; bx += TRANSPOSEBLOCK)
+   {
+      xend = bx + TRANSPOSEBLOCK;
+      if (xend > viewwidth)
+         xend = viewwidth;
+
+      for (by = 0; by < viewheight; by += TRANSPOSEBLOCK)
+      {
+         yend = by + TRANSPOSEBLOCK;
+         if (yend > viewheight)
+            yend = viewheight;
+
+         for (y = by; y < yend; y++)
+         {
+            byte *src = viewcolumns + bx * viewheight + y;
+            byte *dst = dest + y * bufferPitch;
+
+            for (x = bx; x < xend; x++, src += viewheight)
+               dst[x] = *src;
+         }
+      }
+   }
+
+   VL_UnlockSurface(screenBuffer);
+}
+
+/*
+ * Everything the 3D view is drawn from is collected into viewstate each
+ * frame. When it matches the state of the last drawn frame, the view
+ * would come out the same, so the saved one is shown again instead.
+ * The view is only made of palette indices, so palette shifts don't
+ * change it.
+ */
+static byte     *viewstate, *lastviewstate;
+static unsigned viewstatesize, lastviewstatesize, viewstatemax, lastviewstatemax;
+
+static byte     *lastview;          /* the 3D view of the last drawn frame */
+static unsigned lastviewsize;
+static boolean  lastviewvalid;
+
+static void AddViewState (const void *data, unsigned size)
+{
+   if (viewstatesize + size > viewstatemax)
+   {
+      viewstatemax = (viewstatesize + size) * 2;
+      viewstate    = (byte *) realloc(viewstate, viewstatemax);
+      CHECKMALLOCRESULT(viewstate);
+   }
+
+   memcpy(viewstate + viewstatesize, data, size);
+   viewstatesize += size;
+}
+
+/*
+========================
+=
+= ViewChanged
+=
+= Collects the view state of this frame and compares it to the last one
+=
+========================
+*/
+
+static boolean ViewChanged (void)
+{
+   int        i;
+   boolean    changed;
+   byte       *swap;
+   unsigned   swapmax;
+   statobj_t  *statptr;
+   objtype    *obj;
+   struct
+   {
+      fixed   viewx, viewy;
+      short   viewangle, tilex, tiley;
+      int     viewwidth, viewheight;
+      unsigned screenofs;
+      boolean transposed;
+      int     episode, mapon;
+      word    pwallstate, pwallpos, pwallx, pwally;
+      byte    pwalldir, pwalltile;
+      short   doornum;
+      short   weapon, weaponframe;
+      boolean victoryflag, deathcam, demo;
+   } view;
+   struct
+   {
+      byte       tilex, tiley;
+      short      shapenum;
+      uint32_t   flags;
+   } stat;
+   struct
+   {
+      fixed      x, y;
+      word       tilex, tiley;
+      statetype  *state;
+      short      temp1, angle;
+      int        dir, obclass;
+      uint32_t   flags;
+   } actor;
+
+   viewstatesize = 0;
+
+   memset(&view, 0, sizeof(view));
+   view.viewx       = viewx;
+   view.viewy       = viewy;
+   view.viewangle   = viewangle;
+   view.tilex       = player->tilex;
+   view.tiley       = player->tiley;
+   view.viewwidth   = viewwidth;
+   view.viewheight  = viewheight;
+   view.screenofs   = screenofs;
+   view.transposed  = param_transposedview;
+   view.episode     = gamestate.episode;
+   view.mapon       = mapon;
+   view.pwallstate  = pwallstate;
+   view.pwallpos    = pwallpos;
+   view.pwallx      = pwallx;
+   view.pwally      = pwally;
+   view.pwalldir    = pwalldir;
+   view.pwalltile   = pwalltile;
+   view.doornum     = doornum;
+   view.weapon      = gamestate.weapon;
+   view.weaponframe = gamestate.weaponframe;
+   view.victoryflag = gamestate.victoryflag;
+   view.deathcam    = player->state == &s_deathcam && (GetTimeCount()&32);
+   view.demo        = demorecord || demoplayback;
+   AddViewState(&view, sizeof(view));
+
+   AddViewState(tilemap, sizeof(tilemap));
+   AddViewState(doorposition, doornum * sizeof(doorposition[0]));
+   for (i = 0; i < doornum; i++)
+      AddViewState(&doorobjlist[i].lock, sizeof(doorobjlist[i].lock));
+
+   memset(&stat, 0, sizeof(stat));
+   for (statptr = &statobjlist[0]; statptr != laststatobj; statptr++)
+   {
+      stat.tilex    = statptr->tilex;
+      stat.tiley    = statptr->tiley;
+      stat.shapenum = statptr->shapenum;
+      stat.flags    = statptr->flags;
+      AddViewState(&stat, sizeof(stat));
+   }
+
+   memset(&actor, 0, sizeof(actor));
+   for (obj = player->next; obj; obj = obj->next)
+   {
+      actor.x       = obj->x;
+      actor.y       = obj->y;
+      actor.tilex   = obj->tilex;
+      actor.tiley   = obj->tiley;
+      actor.state   = obj->state;
+      actor.temp1   = obj->temp1;
+      actor.angle   = obj->angle;
+      actor.dir     = obj->dir;
+      actor.obclass = obj->obclass;
+      actor.flags   = obj->flags & ~FL_VISABLE;   /* set by DrawScaleds */
+      AddViewState(&actor, sizeof(actor));
+   }
+
+   changed = viewstatesize != lastviewstatesize
+      || memcmp(viewstate, lastviewstate, viewstatesize);
+
+   /* keep this frame's state for the next one */
+   swap              = lastviewstate;
+   lastviewstate     = viewstate;
+   viewstate         = swap;
+   swapmax           = lastviewstatemax;
+   lastviewstatemax  = viewstatemax;
+   viewstatemax      = swapmax;
+   lastviewstatesize = viewstatesize;
+
+   return changed;
+}
+
+/*
+========================
+=
+= GrabBonuses
+=
+= Picks up bonus items in reach like DrawScaleds does,
+= returns true when one was taken and the view has to be drawn
+=
+========================
+*/
+
+static boolean GrabBonuses (void)
+{
+   short     dispx, dispheight;
+   statobj_t *statptr;
+
+   for (statptr = &statobjlist[0]; statptr != laststatobj; statptr++)
+   {
+      if (statptr->shapenum == -1 || !(statptr->flags & FL_BONUS) || !*statptr->visspot)
+         continue;
+
+      if (TransformTile (statptr->tilex, statptr->tiley, &dispx, &dispheight))
+      {
+         GetBonus (statptr);
+         if (statptr->shapenum == -1)
+            return true;
+      }
+   }
+
+   return false;
+}
+
+/*
+========================
+=
+= SaveView / RestoreView
+=
+= Keep a copy of the 3D view in screenBuffer, the column major
+= buffer is only ever written by ThreeDRefresh and needs none
+=
+========================
+*/
+
+static void SaveView (void)
+{
+   int      y;
+   unsigned size = viewwidth * viewheight;
+
+   if (param_transposedview)
+      return;
+
+   if (size > lastviewsize)
+   {
+      free(lastview);
+      lastview     = (byte *) malloc(size);
+      CHECKMALLOCRESULT(lastview);
+      lastviewsize = size;
+   }
+
+   for (y = 0; y < viewheight; y++)
+      memcpy(lastview + y * viewwidth, vbuf + y * vbufPitch, viewwidth);
+}
+
+static void RestoreView (void)
+{
+   int  y;
+   byte *dest;
+
+   if (param_transposedview)
+   {
+      TransposeView();
+      return;
+   }
+
+   dest = VL_LockSurface(screenBuffer) + screenofs;
+   for (y = 0; y < viewheight; y++)
+      memcpy(dest + y * bufferPitch, lastview + y * viewwidth, viewwidth);
+}
+
 //==========================================================================
 
 /*
 ========================
 =
-= ThreeDRefresh
+= DrawView
 =
 ========================
 */
 
-void ThreeDRefresh (void)
+static void DrawView (void)
 {
+   uint64_t stagestart;
+
    /* clear out the traced array */
    memset(spotvis,0,maparea);
 
    /* Detect all sprites over player fix */
    spotvis[player->tilex][player->tiley] = 1;
 
-   vbuf       = VL_LockSurface(screenBuffer);
-   vbuf      += screenofs;
-   vbufPitch  = bufferPitch;
-
-   CalcViewVariables();
+   if (param_transposedview)
+   {
+      vbuf        = GetViewColumns();
+      vbufPitch   = 1;
+      vbufColStep = viewheight;
+   }
+   else
+   {
+      vbuf        = VL_LockSurface(screenBuffer);
+      vbuf       += screenofs;
+      vbufPitch   = bufferPitch;
+      vbufColStep = 1;
+   }
 
    /* follow the walls from there to the right, drawing as we go */
    ClearScreen ();
 
+   stagestart = ProfBegin(prof_walls);
    WallRefresh ();
+   ProfEnd(prof_walls, stagestart);
 
    /* draw all the scaled images */
+   stagestart = ProfBegin(prof_sprites);
    DrawScaleds();          /* draw scaled stuff */
+   ProfEnd(prof_sprites, stagestart);
+
+   stagestart = ProfBegin(prof_weapon);
    DrawPlayerWeapon ();    /* draw player's hands */
+   ProfEnd(prof_weapon, stagestart);
+
+   if (param_incrementalview)
+   {
+      SaveView();
+      lastviewvalid = true;
+   }
+
+   if (param_transposedview)
+      TransposeView();
+}
+
+//==========================================================================
+
+/*
+========================
+=
+= ThreeDRefresh
+=
+========================
+*/
+
+void ThreeDRefresh (void)
+{
+   uint64_t stagestart;
+
+   /* pages from the last frame may be evicted from now on */
+   PM_UnpinPages();
+
+   CalcViewVariables();
+
+   /* nothing changed since the last frame? */
+   if (param_incrementalview && lastviewvalid && !ViewChanged() && !GrabBonuses())
+      RestoreView();
+   else
+      DrawView();
 
    if(Keyboard[sc_Tab] && viewsize == 21 && gamestate.weapon != -1)
       ShowActStatus();
 
-   VL_UnlockSurface(screenBuffer);
+   if (!param_transposedview)
+      VL_UnlockSurface(screenBuffer);
    vbuf = NULL;
 
    /* show screen and time last cycle */
@@ -1562,5 +2539,12 @@ void ThreeDRefresh (void)
       lasttimecount = GetTimeCount();          // don't make a big tic count
    }
    else
+   {
+      if (profiling)
+         ProfDrawOverlay();
+
+      stagestart = ProfBegin(prof_screen);
       VW_UpdateScreen();
+      ProfEnd(prof_screen, stagestart);
+   }
 }
@@ -571,6 +571,147 @@ static void ScanInfoPlane(void)
    }
 }
 
+/*
+==================
+=
+= PrefetchLevelSounds
+=
+= Prepares the digitized sounds the player, the doors and the actors
+= ScanInfoPlane spawned will make, so their first play doesn't have to
+= resample them.  Sounds left out are still prepared when they are played.
+=
+==================
+*/
+
+static void PrefetchLevelSounds (void)
+{
+   objtype *obj;
+
+   SD_PrefetchSound (ATKPISTOLSND);
+   SD_PrefetchSound (ATKMACHINEGUNSND);
+   SD_PrefetchSound (ATKGATLINGSND);
+   SD_PrefetchSound (OPENDOORSND);
+   SD_PrefetchSound (CLOSEDOORSND);
+   SD_PrefetchSound (PUSHWALLSND);
+   SD_PrefetchSound (SLURPIESND);
+   SD_PrefetchSound (LEVELDONESND);
+
+   for (obj = player->next;obj;obj=obj->next)
+   {
+      switch (obj->obclass)
+      {
+         case guardobj:
+            SD_PrefetchSound (HALTSND);
+            SD_PrefetchSound (NAZIFIRESND);
+            SD_PrefetchSound (DEATHSCREAM1SND);
+            SD_PrefetchSound (DEATHSCREAM2SND);
+            SD_PrefetchSound (DEATHSCREAM3SND);
+#ifndef APOGEE_1_0
+            SD_PrefetchSound (DEATHSCREAM4SND);
+            SD_PrefetchSound (DEATHSCREAM5SND);
+            SD_PrefetchSound (DEATHSCREAM7SND);
+            SD_PrefetchSound (DEATHSCREAM8SND);
+            SD_PrefetchSound (DEATHSCREAM9SND);
+#endif
+            break;
+         case officerobj:
+            SD_PrefetchSound (SPIONSND);
+            SD_PrefetchSound (NAZIFIRESND);
+            SD_PrefetchSound (NEINSOVASSND);
+            break;
+         case ssobj:
+            SD_PrefetchSound (SCHUTZADSND);
+            SD_PrefetchSound (SSFIRESND);
+            SD_PrefetchSound (LEBENSND);
+            break;
+         case dogobj:
+            SD_PrefetchSound (DOGBARKSND);
+            SD_PrefetchSound (DOGATTACKSND);
+            SD_PrefetchSound (DOGDEATHSND);
+            break;
+         case mutantobj:
+            SD_PrefetchSound (NAZIFIRESND);
+            SD_PrefetchSound (AHHHGSND);
+            break;
+#ifndef SPEAR
+         case bossobj:
+            SD_PrefetchSound (GUTENTAGSND);
+            SD_PrefetchSound (BOSSFIRESND);
+            SD_PrefetchSound (MUTTISND);
+            break;
+#ifndef APOGEE_1_0
+         case gretelobj:
+            SD_PrefetchSound (KEINSND);
+            SD_PrefetchSound (NAZIFIRESND);
+            SD_PrefetchSound (MEINSND);
+            break;
+         case giftobj:
+            SD_PrefetchSound (EINESND);
+            SD_PrefetchSound (MISSILEFIRESND);
+            SD_PrefetchSound (DONNERSND);
+            break;
+         case fatobj:
+            SD_PrefetchSound (ERLAUBENSND);
+            SD_PrefetchSound (MISSILEFIRESND);
+            SD_PrefetchSound (ROSESND);
+            break;
+#endif
+         case schabbobj:
+            SD_PrefetchSound (SCHABBSHASND);
+            SD_PrefetchSound (SCHABBSTHROWSND);
+            SD_PrefetchSound (MEINGOTTSND);
+            break;
+         case fakeobj:
+            SD_PrefetchSound (TOT_HUNDSND);
+            SD_PrefetchSound (FLAMETHROWERSND);
+            SD_PrefetchSound (HITLERHASND);
+            break;
+         case mechahitlerobj:
+            SD_PrefetchSound (MECHSTEPSND);
+            SD_PrefetchSound (SCHEISTSND);
+            /* and then the real one climbs out */
+         case realhitlerobj:
+            SD_PrefetchSound (DIESND);
+            SD_PrefetchSound (BOSSFIRESND);
+            SD_PrefetchSound (EVASND);
+            break;
+#else
+         case spectreobj:
+            SD_PrefetchSound (GHOSTSIGHTSND);
+            SD_PrefetchSound (GHOSTFADESND);
+            break;
+         case angelobj:
+            SD_PrefetchSound (ANGELSIGHTSND);
+            SD_PrefetchSound (ANGELFIRESND);
+            SD_PrefetchSound (ANGELTIREDSND);
+            SD_PrefetchSound (ANGELDEATHSND);
+            break;
+         case transobj:
+            SD_PrefetchSound (TRANSSIGHTSND);
+            SD_PrefetchSound (NAZIFIRESND);
+            SD_PrefetchSound (TRANSDEATHSND);
+            break;
+         case uberobj:
+            SD_PrefetchSound (NAZIFIRESND);
+            SD_PrefetchSound (UBERDEATHSND);
+            break;
+         case willobj:
+            SD_PrefetchSound (WILHELMSIGHTSND);
+            SD_PrefetchSound (MISSILEFIRESND);
+            SD_PrefetchSound (WILHELMDEATHSND);
+            break;
+         case deathobj:
+            SD_PrefetchSound (KNIGHTSIGHTSND);
+            SD_PrefetchSound (KNIGHTMISSILESND);
+            SD_PrefetchSound (KNIGHTDEATHSND);
+            break;
+#endif
+         default:
+            break;
+      }
+   }
+}
+
 /*
 ==================
 =
@@ -672,6 +813,7 @@ void SetupGameLevel (void)
 
    /* spawn actors */
    ScanInfoPlane ();
+   PrefetchLevelSounds ();
 
    /* take out the ambush markers */
    map = mapsegs[0];
@@ -998,6 +1140,99 @@ void PlayDemo (int demonumber)
    SD_StopDigitized ();
 }
 
+/*
+=============================================================================
+
+                                TIMEDEMO
+
+=============================================================================
+*/
+
+static uint32_t *timedemoframes;      // microseconds spent on each frame
+static int       numtimedemoframes;
+static int       maxtimedemoframes;
+
+void TimeDemoFrame (uint32_t usec)
+{
+   if (numtimedemoframes == maxtimedemoframes)
+   {
+      maxtimedemoframes = maxtimedemoframes ? maxtimedemoframes * 2 : 1024;
+      timedemoframes = (uint32_t *) realloc(timedemoframes,
+            maxtimedemoframes * sizeof(*timedemoframes));
+      CHECKMALLOCRESULT(timedemoframes);
+   }
+
+   timedemoframes[numtimedemoframes++] = usec;
+}
+
+static int CompareFrameTimes (const void *a, const void *b)
+{
+   uint32_t ta = *(const uint32_t *) a;
+   uint32_t tb = *(const uint32_t *) b;
+
+   return ta < tb ? -1 : ta > tb;
+}
+
+static void ReportTimeDemo (const char *name, uint32_t *frames, int count)
+{
+   uint64_t total = 0;
+   int i;
+
+   if (!count)
+   {
+      printf("timedemo %s: no frames\n", name);
+      return;
+   }
+
+   for (i = 0; i < count; i++)
+      total += frames[i];
+
+   qsort(frames, count, sizeof(*frames), CompareFrameTimes);
+
+   printf("timedemo %s: %i frames in %.3f s, %.1f fps\n", name, count,
+         total / 1000000.0, total ? count * 1000000.0 / total : 0.0);
+   printf("   frame time avg %.3f ms, min %.3f ms, max %.3f ms, p99 %.3f ms\n",
+         total / 1000.0 / count, frames[0] / 1000.0, frames[count - 1] / 1000.0,
+         frames[(count * 99 + 99) / 100 - 1] / 1000.0);
+}
+
+/*
+==================
+=
+= TimeDemo
+=
+= Plays param_timedemo (or every demo) with DEMOTICS per frame and no
+= waiting, and prints how long the frames took
+=
+==================
+*/
+
+void TimeDemo (void)
+{
+   int first = param_timedemo == NUMDEMOS ? 0 : param_timedemo;
+   int last  = param_timedemo == NUMDEMOS ? NUMDEMOS - 1 : param_timedemo;
+   int demo, start;
+   char name[16];
+
+   printf("timedemo: %ix%i, view %ix%i\n", screenWidth, screenHeight, viewwidth, viewheight);
+
+   for (demo = first; demo <= last; demo++)
+   {
+      start = numtimedemoframes;
+      PlayDemo (demo);
+
+      snprintf(name, sizeof(name), "demo %i", demo);
+      ReportTimeDemo(name, timedemoframes + start, numtimedemoframes - start);
+   }
+
+   if (last > first)
+      ReportTimeDemo("total", timedemoframes, numtimedemoframes);
+
+   free(timedemoframes);
+   timedemoframes    = NULL;
+   numtimedemoframes = maxtimedemoframes = 0;
+}
+
 /*
 ==================
 =
@@ -387,7 +387,7 @@ static void BJ_Breathe (void)
    static int which = 0, max = 10;
    int pics[2] = { L_GUYPIC, L_GUY2PIC };
 
-   rarch_sleep(5);
+   LR_Delay(5);
 
    if ((int32_t) GetTimeCount () - lastBreathTime > max)
    {
@@ -7,6 +7,17 @@
 #endif
 
 #include "wl_def.h"
+#include "tasks.h"
+
+#ifdef __LIBRETRO__
+#include <setjmp.h>
+#ifdef _WIN32
+    #include <direct.h>
+    #define chdir _chdir
+#endif
+#include "libretro.h"
+#include <rthreads/rthreads.h>
+#endif
 
 /*
 =============================================================================
@@ -96,6 +107,21 @@ int     param_joystickhat = -1;
 int     param_mission = 0;
 boolean param_goodtimes = false;
 boolean param_ignorenumchunks = false;
+int     param_renderthreads = 1;        // number of column bands traced in parallel
+int     param_scalercache = 2048;       // kilobytes of precomputed wall post scalers
+boolean param_transposedview = false;   // draw the 3D view column major
+boolean param_incrementalview = true;   // reuse the 3D view while nothing in it changes
+int     param_timedemo = -1;            // demo to benchmark, NUMDEMOS for all of them
+boolean param_profile = false;          // show the frame profiler overlay
+char    param_profilecsv[256] = "";     // file the frame profiler writes to
+char    param_trace[256] = "";          // file the trace events are written to
+boolean param_mmapvswap = true;         // map the page file instead of reading it
+int     param_pagecache = 0;            // kilobytes of VSWAP pages kept loaded, 0 for all
+int     param_soundcache = 0;           // kilobytes of digitized sounds copied from cached pages, 0 for all
+boolean param_huffbench = false;        // benchmark the graphics decompression and quit
+int     param_mapcache = MAPCACHE_MEMORY; // where expanded maps are kept
+boolean param_buildpack = false;        // write the asset pack and quit
+int     param_startupthreads = 0;       // threads loading the data, 0 for one per CPU
 
 /*
 =============================================================================
@@ -600,12 +626,16 @@ boolean LoadTheGame(FILE *file,int x,int y)
 
 void ShutdownId (void)
 {
+    ProfShutdown ();
+    ShutdownRefreshThreads ();
     US_Shutdown ();
     SD_Shutdown ();
     PM_Shutdown ();
     IN_Shutdown ();
     VW_Shutdown ();
     CA_Shutdown ();
+    PK_Shutdown ();
+    LR_TraceShutdown ();
 }
 
 
@@ -895,7 +925,6 @@ static void InitDigiMap (void)
     {
         DigiMap[map[0]] = map[1];
         DigiChannel[map[1]] = map[2];
-        SD_PrepareSound(map[1]);
     }
 }
 
@@ -989,7 +1018,7 @@ void DoJukebox(void)
 
 #ifndef SPEAR
 #ifndef UPLOAD
-    start = ((LR_GetTicks()/10)%3)*6;
+    start = ((LR_GetGameTicks()/10)%3)*6;
 #else
     start = 0;
 #endif
@@ -1055,6 +1084,68 @@ void DoJukebox(void)
 }
 #endif
 
+/*
+==========================
+=
+= RunStartupTasks
+=
+= Loads the data files, loads the latches and builds the tables on up to
+= --startupthreads threads.  The sound manager needs the page file and
+= the latches need the graphics, the rest does not depend on each other.
+= The digitized sounds are prepared once they are needed.
+=
+==========================
+*/
+
+static void StartPageManager (int arg)
+{
+   PM_Startup ();
+}
+
+static void StartCacheManager (int arg)
+{
+   CA_Startup ();
+}
+
+static void StartSoundManager (int arg)
+{
+   SD_Startup ();
+   InitDigiMap ();
+}
+
+static void StartLatches (int arg)
+{
+   /* load in and lock down some basic chunks */
+   CA_CacheGrChunk(STARTFONT);
+   CA_CacheGrChunk(STATUSBARPIC);
+
+   LoadLatchMem ();
+}
+
+static void StartTables (int arg)
+{
+   BuildTables ();          /* trig tables */
+   SetupWalls ();
+}
+
+static void RunStartupTasks (void)
+{
+   const char *error;
+   int pm, ca, sd;
+
+   pm = LR_TaskAdd("PM_Startup", StartPageManager, 0);
+   ca = LR_TaskAdd("CA_Startup", StartCacheManager, 0);
+   sd = LR_TaskAdd("SD_Startup", StartSoundManager, 0);
+   LR_TaskDepends(sd, pm);
+
+   LR_TaskDepends(LR_TaskAdd("LoadLatchMem", StartLatches, 0), ca);
+   LR_TaskAdd("BuildTables", StartTables, 0);
+
+   error = LR_TaskRun(param_startupthreads);
+   if (error)
+      Quit("%s", error);
+}
+
 /*
 ==========================
 =
@@ -1071,24 +1162,35 @@ static void InitGame(void)
    boolean didjukebox=false;
 #endif
 
+#ifndef __LIBRETRO__
+   /* a timedemo neither shows anything nor plays anything */
+   if (param_timedemo != -1 || param_huffbench || param_buildpack)
+   {
+      putenv("SDL_VIDEODRIVER=dummy");
+      putenv("SDL_AUDIODRIVER=dummy");
+   }
+#endif
+
    /* initialize SDL */
    if(LR_Init(0) < 0)
       exit(1);
    atexit(LR_Quit);
 
+   LR_TraceStartup(param_trace);
+
+   /* the pack is built from and benchmarked against the original files */
+   if (!param_buildpack && !param_huffbench)
+      PK_Startup ();
+
    SignonScreen ();
 
    VH_Startup ();
    IN_Startup ();
-   PM_Startup ();
-   SD_Startup ();
-   CA_Startup ();
    US_Startup ();
 
    /* TODO: Will any memory checking be needed someday?? */
 
-   /* build some tables */
-   InitDigiMap ();
+   RunStartupTasks ();
 
    ReadConfig ();
 
@@ -1106,18 +1208,11 @@ static void InitGame(void)
       /* draw intro screen stuff */
       IntroScreen ();
 
-   /* load in and lock down some basic chunks */
-   CA_CacheGrChunk(STARTFONT);
-   CA_CacheGrChunk(STATUSBARPIC);
-
-   LoadLatchMem ();
-   BuildTables ();          /* trig tables */
-   SetupWalls ();
-
    NewViewSize (viewsize);
 
    /* initialize variables */
    InitRedShifts ();
+   ProfStartup ();
 #ifndef SPEARDEMO
    if(!didjukebox)
 #endif
@@ -1203,6 +1298,55 @@ void NewViewSize (int width)
    SetViewSize(viewwidth, viewheight);
 }
 
+#ifdef __LIBRETRO__
+/*
+=============================================================================
+
+                            LIBRETRO GAME THREAD
+
+The game code is written as a blocking loop, so under libretro it runs on a
+thread of its own.  Only one side runs at a time: retro_run hands the thread
+its turn and waits, and the game hands it back from LR_YieldFrame whenever a
+frame is finished or it has to wait for time to pass.  Game time is counted
+in those turns, so every retro_run advances it by exactly one frame.
+
+=============================================================================
+*/
+
+#define GAMEFPS 70         // the frame rate reported to the frontend
+
+static sthread_t *gamethread;
+static slock_t   *gamelock;
+static scond_t   *gamecond;
+static boolean    gameturn;       // the game thread may run
+static boolean    gamedone;       // the game thread has left GameMain
+static boolean    gamestop;       // the frontend is unloading the game
+static jmp_buf    gameexit;
+static uint32_t   gameframes;     // frames retro_run has run, the game clock
+static boolean    gameflipped;    // the game presented a new frame this turn
+static void      *gamedata;       // a copy of the content, mounted under its name
+#endif
+
+/*
+==========================
+=
+= ExitGame
+=
+= Under libretro the process must keep running, so leave the game thread
+= instead of exiting
+=
+==========================
+*/
+
+static void ExitGame(int code)
+{
+#ifdef __LIBRETRO__
+   if (gamethread)
+      longjmp(gameexit, 1);
+#endif
+   exit(code);
+}
+
 /*
 ==========================
 =
@@ -1224,6 +1368,16 @@ void Quit (const char *errorStr, ...)
     else
        error[0] = 0;
 
+    /* code run through LR_TaskCatch only ends, whoever ran it quits */
+    LR_TaskAbort(error);
+
+    /* shutting down joins and frees what the other threads are using */
+    if (!LR_TaskIsGameThread())
+    {
+        puts(error);
+        abort();
+    }
+
     /* don't try to display the red box before it's loaded */
     if (!pictable)  
     {
@@ -1233,7 +1387,7 @@ void Quit (const char *errorStr, ...)
             puts(error);
             VW_WaitVBL(100);
         }
-        exit(1);
+        ExitGame(1);
     }
 
     if (!error || !*error)
@@ -1245,10 +1399,10 @@ void Quit (const char *errorStr, ...)
     {
         puts(error);
         VW_WaitVBL(200);
-        exit(1);
+        ExitGame(1);
     }
 
-    exit(0);
+    ExitGame(0);
 }
 
 /*
@@ -1519,6 +1673,173 @@ static void CheckParameters(int argc, char *argv[])
                 }
             }
         }
+        else if(!strcmp(arg, ("--renderthreads")))
+        {
+            if(++i >= argc)
+            {
+                printf("The renderthreads option is missing the count argument!\n");
+                hasError = true;
+            }
+            else
+            {
+                param_renderthreads = atoi(argv[i]);
+                if(param_renderthreads < 1 || param_renderthreads > 16)
+                {
+                    printf("The renderthreads option must be between 1 and 16!\n");
+                    hasError = true;
+                }
+            }
+        }
+        else if(!strcmp(arg, ("--scalercache")))
+        {
+            if(++i >= argc)
+            {
+                printf("The scalercache option is missing the size argument!\n");
+                hasError = true;
+            }
+            else
+            {
+                param_scalercache = atoi(argv[i]);
+                if(param_scalercache < 0)
+                {
+                    printf("The scalercache size must not be negative!\n");
+                    hasError = true;
+                }
+            }
+        }
+        else if(!strcmp(arg, ("--timedemo")))
+        {
+            if(++i >= argc)
+            {
+                printf("The timedemo option is missing the demo argument!\n");
+                hasError = true;
+            }
+            else
+            {
+                if(!strcmp(argv[i], "all"))
+                    param_timedemo = NUMDEMOS;
+                else
+                    param_timedemo = atoi(argv[i]);
+                if(param_timedemo < 0 || param_timedemo > NUMDEMOS)
+                {
+                    printf("The timedemo option must be a demo number between 0 and %i or \"all\"!\n", NUMDEMOS - 1);
+                    hasError = true;
+                }
+                param_nowait = true;
+            }
+        }
+        else if(!strcmp(arg, ("--mapcache")))
+        {
+            if(++i >= argc)
+            {
+                printf("The mapcache option is missing the mode argument!\n");
+                hasError = true;
+            }
+            else if(!strcmp(argv[i], "off"))
+                param_mapcache = MAPCACHE_OFF;
+            else if(!strcmp(argv[i], "memory"))
+                param_mapcache = MAPCACHE_MEMORY;
+            else if(!strcmp(argv[i], "disk"))
+                param_mapcache = MAPCACHE_DISK;
+            else
+            {
+                printf("The mapcache mode must be \"off\", \"memory\" or \"disk\"!\n");
+                hasError = true;
+            }
+        }
+        else if(!strcmp(arg, ("--buildpack")))
+            param_buildpack = true;
+        else if(!strcmp(arg, ("--startupthreads")))
+        {
+            if(++i >= argc)
+            {
+                printf("The startupthreads option is missing the count argument!\n");
+                hasError = true;
+            }
+            else
+            {
+                param_startupthreads = atoi(argv[i]);
+                if(param_startupthreads < 0 || param_startupthreads > MAXTASKTHREADS)
+                {
+                    printf("The startupthreads option must be between 0 and %i!\n", MAXTASKTHREADS);
+                    hasError = true;
+                }
+            }
+        }
+        else if(!strcmp(arg, ("--huffbench")))
+            param_huffbench = true;
+        else if(!strcmp(arg, ("--profile")))
+            param_profile = true;
+        else if(!strcmp(arg, ("--profilecsv")))
+        {
+            if(++i >= argc)
+            {
+                printf("The profilecsv option is missing the file argument!\n");
+                hasError = true;
+            }
+            else if(strlen(argv[i]) + 1 > sizeof(param_profilecsv))
+            {
+                printf("The profilecsv file name is too long!\n");
+                hasError = true;
+            }
+            else
+                strcpy(param_profilecsv, argv[i]);
+        }
+        else if(!strcmp(arg, ("--trace")))
+        {
+            if(++i >= argc)
+            {
+                printf("The trace option is missing the file argument!\n");
+                hasError = true;
+            }
+            else if(strlen(argv[i]) + 1 > sizeof(param_trace))
+            {
+                printf("The trace file name is too long!\n");
+                hasError = true;
+            }
+            else
+                strcpy(param_trace, argv[i]);
+        }
+        else if(!strcmp(arg, ("--nommap")))
+            param_mmapvswap = false;
+        else if(!strcmp(arg, ("--pagecache")))
+        {
+            if(++i >= argc)
+            {
+                printf("The pagecache option is missing the size argument!\n");
+                hasError = true;
+            }
+            else
+            {
+                param_pagecache = atoi(argv[i]);
+                if(param_pagecache < 0)
+                {
+                    printf("The pagecache size must not be negative!\n");
+                    hasError = true;
+                }
+            }
+        }
+        else if(!strcmp(arg, ("--soundcache")))
+        {
+            if(++i >= argc)
+            {
+                printf("The soundcache option is missing the size argument!\n");
+                hasError = true;
+            }
+            else
+            {
+                param_soundcache = atoi(argv[i]);
+                if(param_soundcache < 0)
+                {
+                    printf("The soundcache size must not be negative!\n");
+                    hasError = true;
+                }
+            }
+        }
+        else if(!strcmp(arg, ("--fullrefresh")))
+            param_incrementalview = false;
+        else if(!strcmp(arg, ("--transposedview")))
+            param_transposedview = true;
         else if(!strcmp(arg, ("--goodtimes")))
             param_goodtimes = true;
         else if(!strcmp(arg, ("--ignorenumchunks")))
@@ -1550,6 +1871,41 @@ static void CheckParameters(int argc, char *argv[])
             " --joystickhat <index>  Enables movement with the given coolie hat\n"
             " --ignorenumchunks      Ignores the number of chunks in VGAHEAD.*\n"
             "                        (may be useful for some broken mods)\n"
+            " --renderthreads <n>    Traces the walls in n column bands in parallel\n"
+            "                        (1-16, default: 1)\n"
+            " --scalercache <kb>     Memory used for precomputed wall post scalers\n"
+            "                        (0 disables them, default: 2048)\n"
+            " --fullrefresh          Draws the 3D view every frame, even if nothing\n"
+            "                        in it changed since the last one\n"
+            " --transposedview       Draws the 3D view column by column into a\n"
+            "                        separate buffer and transposes it afterwards\n"
+            " --nommap               Reads the whole page file (VSWAP) into memory\n"
+            "                        instead of mapping it\n"
+            " --pagecache <kb>       Loads VSWAP pages on demand and keeps at most\n"
+            "                        kb kilobytes of them (default: 0, all pages)\n"
+            " --soundcache <kb>      With --pagecache, keeps at most kb kilobytes of\n"
+            "                        digitized sounds copied from the pages (default:\n"
+            "                        0, all that were played)\n"
+            " --mapcache <mode>      Keeps all maps expanded in memory, filled in the\n"
+            "                        background (memory, the default), also stores\n"
+            "                        them in the config dir (disk), or not (off)\n"
+            " --profile              Shows how long each stage of a frame takes\n"
+            "                        (toggled with Tab+R in debug mode)\n"
+            " --profilecsv <file>    Writes the stage times of every frame to file\n"
+            " --trace <file>         Records frame stages, loads, sound preparation and\n"
+            "                        mixing per thread and writes them to file in the\n"
+            "                        Chrome trace event format on exit\n"
+            " --timedemo <demo|all>  Plays the given demo (or all of them) as fast as\n"
+            "                        possible without video or audio output, then\n"
+            "                        prints frame time statistics and quits\n"
+            " --buildpack            Writes all game data decompressed into pack.ext,\n"
+            "                        which is then loaded instead of the original\n"
+            "                        files, and quits\n"
+            " --huffbench            Decompresses all graphics with the old and the\n"
+            "                        table driven Huffman decoder, prints how long\n"
+            "                        each took and quits\n"
+            " --startupthreads <n>   Loads the game data on n threads and prints how\n"
+            "                        long each step took (0-16, default: 0, one per CPU)\n"
             " --configdir <dir>      Directory where config file and save games are stored\n"
 #if defined(_WIN32)
             "                        (default: current directory)\n"
@@ -1585,6 +1941,24 @@ static void retro_run(void)
 {
    int ret = JE_NONE;
 
+   if (param_buildpack)
+   {
+      PK_BuildPack();
+      Quit(NULL);
+   }
+
+   if (param_huffbench)
+   {
+      CA_HuffBenchmark();
+      Quit(NULL);
+   }
+
+   if (param_timedemo != -1)
+   {
+      TimeDemo();
+      Quit(NULL);
+   }
+
    for (;;)
    {
       ret = DemoLoop(ret);
@@ -1611,6 +1985,8 @@ static void retro_deinit(void)
 
 int main (int argc, char *argv[])
 {
+   LR_TaskGameThread();
+
    retro_init();
    retro_load_game(argc, argv);
    retro_run();
@@ -1619,4 +1995,462 @@ int main (int argc, char *argv[])
 
    return 1;
 }
+#else
+static retro_environment_t        environ_cb;
+static retro_video_refresh_t      video_cb;
+static retro_audio_sample_t       audio_cb;
+static retro_audio_sample_batch_t audio_batch_cb;
+static retro_input_poll_t         input_poll_cb;
+static retro_input_state_t        input_state_cb;
+
+/*
+ * Joypad buttons are fed to the game as the keys of its default controls.
+ */
+static const struct
+{
+   unsigned id;
+   ScanCode scan;
+} joypadkeys[] =
+{
+   { RETRO_DEVICE_ID_JOYPAD_UP,     sc_UpArrow },
+   { RETRO_DEVICE_ID_JOYPAD_DOWN,   sc_DownArrow },
+   { RETRO_DEVICE_ID_JOYPAD_LEFT,   sc_LeftArrow },
+   { RETRO_DEVICE_ID_JOYPAD_RIGHT,  sc_RightArrow },
+   { RETRO_DEVICE_ID_JOYPAD_B,      sc_Control },
+   { RETRO_DEVICE_ID_JOYPAD_A,      sc_Space },
+   { RETRO_DEVICE_ID_JOYPAD_Y,      sc_RShift },
+   { RETRO_DEVICE_ID_JOYPAD_X,      sc_Return },
+   { RETRO_DEVICE_ID_JOYPAD_L,      sc_Alt },
+   { RETRO_DEVICE_ID_JOYPAD_R,      sc_Alt },
+   { RETRO_DEVICE_ID_JOYPAD_SELECT, sc_Tab },
+   { RETRO_DEVICE_ID_JOYPAD_START,  sc_Escape },
+};
+
+static boolean joypadstate[lengthof(joypadkeys)];
+static bool    candupe;           // the frontend shows the last frame for NULL
+
+#ifdef HAVE_THREADS
+/*
+==========================
+=
+= GameMain
+=
+==========================
+*/
+
+static void GameMain(void)
+{
+   static char *argv[] = { "wolf3d", NULL };
+   int ret = JE_NONE;
+
+   CheckParameters(1, argv);
+
+   CheckForEpisodes();
+
+   InitGame();
+
+   while ((ret = DemoLoop(ret)) != JE_QUIT)
+      ;
+
+   Quit(NULL);
+}
+
+/*
+==========================
+=
+= GameThread
+=
+==========================
+*/
+
+static void GameThread(void *data)
+{
+   LR_TaskGameThread();
+
+   slock_lock(gamelock);
+   while (!gameturn)
+      scond_wait(gamecond, gamelock);
+   slock_unlock(gamelock);
+
+   if (!setjmp(gameexit))
+      GameMain();
+
+   slock_lock(gamelock);
+   gamedone = true;
+   gameturn = false;
+   scond_signal(gamecond);
+   slock_unlock(gamelock);
+}
+
+int LR_FrameDriven(void)
+{
+   return gamethread != NULL;
+}
+
+/*
+==========================
+=
+= LR_YieldFrame
+=
+= Called on the game thread: hands control back to retro_run and waits for
+= the next frame.  Once the frontend unloads the game, the thread quits
+= through the normal shutdown path and never waits again.
+=
+==========================
+*/
+
+void LR_YieldFrame(void)
+{
+   if (!gamethread || gamestop)
+      return;
+
+   slock_lock(gamelock);
+   gameturn = false;
+   scond_signal(gamecond);
+   while (!gameturn)
+      scond_wait(gamecond, gamelock);
+   slock_unlock(gamelock);
+
+   if (gamestop)
+      Quit(NULL);
+}
+
+static void RunGameThread(void)
+{
+   slock_lock(gamelock);
+   gameturn = true;
+   scond_signal(gamecond);
+   while (gameturn)
+      scond_wait(gamecond, gamelock);
+   slock_unlock(gamelock);
+}
+#else
+int LR_FrameDriven(void)
+{
+   return 0;
+}
+
+void LR_YieldFrame(void)
+{
+}
+
+static void RunGameThread(void)
+{
+}
+#endif
+
+/*
+==========================
+=
+= LR_FrameTime
+=
+= The game clock in milliseconds.  Rounded up, so the 70 Hz tics the game
+= derives from it step once with every frame at GAMEFPS 70.
+=
+==========================
+*/
+
+uint32_t LR_FrameTime(void)
+{
+   return (uint32_t) (((uint64_t) gameframes * 1000 + GAMEFPS - 1) / GAMEFPS);
+}
+
+/*
+==========================
+=
+= LR_PresentFrame
+=
+= Called on the game thread by LR_Flip: retro_run shows the screen once the
+= thread yields, which only happens for frames that were flipped
+=
+==========================
+*/
+
+void LR_PresentFrame(void)
+{
+   gameflipped = true;
+   LR_YieldFrame();
+}
+
+static void KeyboardEvent(bool down, unsigned keycode,
+      uint32_t character, uint16_t key_modifiers)
+{
+   IN_KeyEvent(keycode, down);
+}
+
+static void PollJoypad(void)
+{
+   unsigned i;
+
+   input_poll_cb();
+
+   for (i = 0; i < lengthof(joypadkeys); i++)
+   {
+      boolean pressed = input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, joypadkeys[i].id) != 0;
+
+      if (pressed != joypadstate[i])
+      {
+         joypadstate[i] = pressed;
+         IN_KeyEvent(joypadkeys[i].scan, pressed);
+      }
+   }
+}
+
+void retro_set_environment(retro_environment_t cb)
+{
+   struct retro_keyboard_callback keyboard = { KeyboardEvent };
+
+   environ_cb = cb;
+   environ_cb(RETRO_ENVIRONMENT_SET_KEYBOARD_CALLBACK, &keyboard);
+}
+
+void retro_set_video_refresh(retro_video_refresh_t cb)             { video_cb = cb; }
+void retro_set_audio_sample(retro_audio_sample_t cb)               { audio_cb = cb; }
+void retro_set_audio_sample_batch(retro_audio_sample_batch_t cb)   { audio_batch_cb = cb; }
+void retro_set_input_poll(retro_input_poll_t cb)                   { input_poll_cb = cb; }
+void retro_set_input_state(retro_input_state_t cb)                 { input_state_cb = cb; }
+
+unsigned retro_api_version(void)
+{
+   return RETRO_API_VERSION;
+}
+
+void retro_get_system_info(struct retro_system_info *info)
+{
+   memset(info, 0, sizeof(*info));
+   info->library_name     = "Wolfenstein 3D";
+   info->library_version  = "v1.0";
+   info->need_fullpath    = false;
+   info->valid_extensions = "wl6|wl1|sod|sdm";
+}
+
+void retro_get_system_av_info(struct retro_system_av_info *info)
+{
+   memset(info, 0, sizeof(*info));
+   info->geometry.base_width   = screenWidth;
+   info->geometry.base_height  = screenHeight;
+   info->geometry.max_width    = screenWidth;
+   info->geometry.max_height   = screenHeight;
+   info->geometry.aspect_ratio = 4.0f / 3.0f;
+   info->timing.fps            = GAMEFPS;
+   info->timing.sample_rate    = 44100;
+}
+
+void retro_init(void)
+{
+}
+
+void retro_deinit(void)
+{
+}
+
+void retro_set_controller_port_device(unsigned port, unsigned device)
+{
+}
+
+void retro_reset(void)
+{
+}
+
+/*
+==========================
+=
+= retro_load_game
+=
+= The content is mounted under its file name, so it is read from memory,
+= the rest of the game data from the directory holding it.  Loading a pack
+= built with --buildpack that way needs no data files at all.  The config
+= file and save games go to the frontend's save directory.
+=
+==========================
+*/
+
+bool retro_load_game(const struct retro_game_info *game)
+{
+#ifdef HAVE_THREADS
+   const char *savedir = NULL;
+   const char *name;
+   char dir[256];
+   char *slash;
+#ifdef FRONTEND_SUPPORTS_RGB565
+   enum retro_pixel_format fmt = RETRO_PIXEL_FORMAT_RGB565;
+#else
+   enum retro_pixel_format fmt = RETRO_PIXEL_FORMAT_XRGB8888;
+#endif
+
+   if (!environ_cb(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &fmt))
+      return false;
+
+   if (!environ_cb(RETRO_ENVIRONMENT_GET_CAN_DUPE, &candupe))
+      candupe = false;
+
+   if (game && game->path && game->data && game->size)
+   {
+      /* archives come as archive#file */
+      name = game->path + strlen(game->path);
+      while (name > game->path && name[-1] != '/' && name[-1] != '\\' && name[-1] != '#')
+         name--;
+
+      /* the frontend only keeps the data valid during this call */
+      gamedata = malloc(game->size);
+      if (!gamedata)
+         return false;
+      memcpy(gamedata, game->data, game->size);
+      if (!VF_Mount(name, gamedata, game->size))
+      {
+         free(gamedata);
+         gamedata = NULL;
+      }
+   }
+
+   if (game && game->path)
+   {
+      snprintf(dir, sizeof(dir), "%s", game->path);
+      slash = strrchr(dir, '/');
+      if (!slash)
+         slash = strrchr(dir, '\\');
+      if (slash)
+      {
+         *slash = 0;
+         /* mounted content may not need the directory */
+         if (chdir(dir) && !gamedata)
+            return false;
+      }
+   }
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY, &savedir) && savedir
+         && strlen(savedir) + 2 <= sizeof(configdir))
+      snprintf(configdir, sizeof(configdir), "%s/", savedir);
+
+   gamelock = slock_new();
+   gamecond = scond_new();
+   gameturn = gamedone = gamestop = false;
+   gameframes = 0;
+   if (gamelock && gamecond)
+      gamethread = sthread_create(GameThread, NULL);
+
+   if (!gamethread)
+   {
+      scond_free(gamecond);
+      slock_free(gamelock);
+      gamecond = NULL;
+      gamelock = NULL;
+      VF_UnmountAll();
+      free(gamedata);
+      gamedata = NULL;
+      return false;
+   }
+
+   return true;
+#else
+   printf("The libretro core needs thread support (HAVE_THREADS)\n");
+   return false;
+#endif
+}
+
+bool retro_load_game_special(unsigned type, const struct retro_game_info *info, size_t num)
+{
+   return false;
+}
+
+void retro_unload_game(void)
+{
+#ifdef HAVE_THREADS
+   if (!gamethread)
+      return;
+
+   slock_lock(gamelock);
+   gamestop = true;
+   gameturn = true;
+   scond_signal(gamecond);
+   slock_unlock(gamelock);
+
+   sthread_join(gamethread);
+   gamethread = NULL;
+
+   scond_free(gamecond);
+   slock_free(gamelock);
+   gamecond = NULL;
+   gamelock = NULL;
+
+   VF_UnmountAll();
+   free(gamedata);
+   gamedata = NULL;
+#endif
+}
+
+/*
+==========================
+=
+= retro_run
+=
+= Advances the game clock by one frame, runs the game thread until it
+= yields and hands the screen surface straight to the frontend if the game
+= flipped it, or repeats the last frame otherwise
+=
+==========================
+*/
+
+void retro_run(void)
+{
+   if (gamedone)
+      return;
+
+   PollJoypad();
+
+   gameframes++;
+   gameflipped = false;
+   RunGameThread();
+
+   if (gamedone)
+   {
+      environ_cb(RETRO_ENVIRONMENT_SHUTDOWN, NULL);
+      return;
+   }
+
+   if (!screen || !screen->surf)
+      return;
+
+   /* screen still holds the last flipped frame */
+   video_cb(gameflipped || !candupe ? screen->surf->pixels : NULL,
+         screen->surf->w, screen->surf->h, screen->surf->pitch);
+}
+
+unsigned retro_get_region(void)
+{
+   return RETRO_REGION_NTSC;
+}
+
+size_t retro_serialize_size(void)
+{
+   return 0;
+}
+
+bool retro_serialize(void *data, size_t size)
+{
+   return false;
+}
+
+bool retro_unserialize(const void *data, size_t size)
+{
+   return false;
+}
+
+void retro_cheat_reset(void)
+{
+}
+
+void retro_cheat_set(unsigned index, bool enabled, const char *code)
+{
+}
+
+void *retro_get_memory_data(unsigned id)
+{
+   return NULL;
+}
+
+size_t retro_get_memory_size(unsigned id)
+{
+   return 0;
+}
 #endif
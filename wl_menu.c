@@ -1793,7 +1793,7 @@ MouseSensitivity (int unused)
     DrawMouseSens ();
     do
     {
-        rarch_sleep(5);
+        LR_Delay(5);
         ReadAnyControl (&ci);
         switch (ci.dir)
         {
@@ -2060,7 +2060,7 @@ EnterCtrlData (int index, CustomCtrls * cust, void (*DrawRtn) (int), void (*Prin
             redraw = 0;
         }
 
-        rarch_sleep(5);
+        LR_Delay(5);
         ReadAnyControl (&ci);
 
         if (type == MOUSE || type == JOYSTICK)
@@ -2106,7 +2106,7 @@ EnterCtrlData (int index, CustomCtrls * cust, void (*DrawRtn) (int), void (*Prin
                     lastFlashTime = GetTimeCount();
                     VW_UpdateScreen ();
                 }
-                else rarch_sleep(5);
+                else LR_Delay(5);
 
                 //
                 // WHICH TYPE OF INPUT DO WE PROCESS?
@@ -2205,7 +2205,7 @@ EnterCtrlData (int index, CustomCtrls * cust, void (*DrawRtn) (int), void (*Prin
                 while (!cust->allowed[which]);
                 redraw = 1;
                 SD_PlaySound (MOVEGUN1SND);
-                while (ReadAnyControl (&ci), ci.dir != dir_None) rarch_sleep(5);
+                while (ReadAnyControl (&ci), ci.dir != dir_None) LR_Delay(5);
                 IN_ClearKeysDown ();
                 break;
 
@@ -2219,7 +2219,7 @@ EnterCtrlData (int index, CustomCtrls * cust, void (*DrawRtn) (int), void (*Prin
                 while (!cust->allowed[which]);
                 redraw = 1;
                 SD_PlaySound (MOVEGUN1SND);
-                while (ReadAnyControl (&ci), ci.dir != dir_None) rarch_sleep(5);
+                while (ReadAnyControl (&ci), ci.dir != dir_None) LR_Delay(5);
                 IN_ClearKeysDown ();
                 break;
             case dir_North:
@@ -2638,7 +2638,7 @@ int CP_ChangeView (int unused)
     do
     {
         CheckPause ();
-        rarch_sleep(5);
+        LR_Delay(5);
         ReadAnyControl (&ci);
         switch (ci.dir)
         {
@@ -3033,7 +3033,7 @@ HandleMenu (CP_iteminfo * item_i, CP_itemtype * items, void (*routine) (int w))
                 routine (which);
             VW_UpdateScreen ();
         }
-        else rarch_sleep(5);
+        else LR_Delay(5);
 
         CheckPause ();
 
@@ -3205,7 +3205,7 @@ void DrawHalfStep (int x, int y)
     VWB_DrawPic (x, y, C_CURSOR1PIC);
     VW_UpdateScreen ();
     SD_PlaySound (MOVEGUN1SND);
-    rarch_sleep (8 * 100 / 7);
+    LR_Delay(8 * 100 / 7);
 }
 
 
@@ -3241,7 +3241,7 @@ void TicDelay (int count)
 
     do
     {
-        rarch_sleep(5);
+        LR_Delay(5);
         ReadAnyControl (&ci);
         if (ci.dir == dir_None)
            break;
@@ -3375,7 +3375,7 @@ Confirm (const char *string)
             tick ^= 1;
             lastBlinkTime = GetTimeCount();
         }
-        else rarch_sleep(5);
+        else LR_Delay(5);
 
 #ifdef SPANISH
     }
@@ -3618,6 +3618,29 @@ void ShootSnd (void)
 // CHECK FOR EPISODES
 //
 ///////////////////////////////////////////////////////////////////////////
+/*
+=================
+=
+= DataFilesExist
+=
+= The data files with extension ext are there, on disk or mounted, or a
+= pack built from them is
+=
+=================
+*/
+
+static boolean DataFilesExist (const char *ext)
+{
+   char fname[13];
+
+   snprintf(fname, sizeof(fname), "vswap.%s", ext);
+   if (VF_Exists(fname))
+      return true;
+
+   snprintf(fname, sizeof(fname), "pack.%s", ext);
+   return VF_Exists(fname);
+}
+
 void CheckForEpisodes (void)
 {
    struct stat statbuf;
@@ -3660,12 +3683,12 @@ void CheckForEpisodes (void)
    /* JAPANESE VERSION */
 #ifdef JAPAN
 #ifdef JAPDEMO
-   if(!stat("vswap.wj1", &statbuf))
+   if(DataFilesExist("wj1"))
    {
       strcpy (extension, "wj1");
       numEpisodesMissing = 5;
 #else
-      if(!stat("vswap.wj6", &statbuf))
+      if(DataFilesExist("wj6"))
       {
          strcpy (extension, "wj6");
 #endif
@@ -3681,7 +3704,7 @@ void CheckForEpisodes (void)
 
       /* ENGLISH */
 #ifdef UPLOAD
-      if(!stat("vswap.wl1", &statbuf))
+      if(DataFilesExist("wl1"))
       {
          strcpy (extension, "wl1");
          numEpisodesMissing = 5;
@@ -3690,7 +3713,7 @@ void CheckForEpisodes (void)
          Quit ("NO WOLFENSTEIN 3-D DATA FILES to be found!");
 #else
 #ifndef SPEAR
-      if(!stat("vswap.wl6", &statbuf))
+      if(DataFilesExist("wl6"))
       {
          strcpy (extension, "wl6");
          NewEmenu[2].active =
@@ -3703,7 +3726,7 @@ void CheckForEpisodes (void)
       }
       else
       {
-         if(!stat("vswap.wl3", &statbuf))
+         if(DataFilesExist("wl3"))
          {
             strcpy (extension, "wl3");
             numEpisodesMissing = 3;
@@ -3711,7 +3734,7 @@ void CheckForEpisodes (void)
          }
          else
          {
-            if(!stat("vswap.wl1", &statbuf))
+            if(DataFilesExist("wl1"))
             {
                strcpy (extension, "wl1");
                numEpisodesMissing = 5;
@@ -3728,28 +3751,28 @@ void CheckForEpisodes (void)
 #ifndef SPEARDEMO
       if(param_mission == 0)
       {
-         if(!stat("vswap.sod", &statbuf))
+         if(DataFilesExist("sod"))
             strcpy (extension, "sod");
          else
             Quit ("NO SPEAR OF DESTINY DATA FILES TO BE FOUND!");
       }
       else if(param_mission == 1)
       {
-         if(!stat("vswap.sd1", &statbuf))
+         if(DataFilesExist("sd1"))
             strcpy (extension, "sd1");
          else
             Quit ("NO SPEAR OF DESTINY DATA FILES TO BE FOUND!");
       }
       else if(param_mission == 2)
       {
-         if(!stat("vswap.sd2", &statbuf))
+         if(DataFilesExist("sd2"))
             strcpy (extension, "sd2");
          else
             Quit ("NO SPEAR OF DESTINY DATA FILES TO BE FOUND!");
       }
       else if(param_mission == 3)
       {
-         if(!stat("vswap.sd3", &statbuf))
+         if(DataFilesExist("sd3"))
             strcpy (extension, "sd3");
          else
             Quit ("NO SPEAR OF DESTINY DATA FILES TO BE FOUND!");
@@ -3759,7 +3782,7 @@ void CheckForEpisodes (void)
       strcpy (graphext, "sod");
       strcpy (audioext, "sod");
 #else
-      if(!stat("vswap.sdm", &statbuf))
+      if(DataFilesExist("sdm"))
       {
          strcpy (extension, "sdm");
       }
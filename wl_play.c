@@ -375,10 +375,12 @@ void PollControls (void)
    IN_ProcessEvents();
 
    /* get timing info for last frame */
-   if (demoplayback || demorecord)   /* demo recording and playback needs to be constant */
+   if (demoplayback && param_timedemo != -1)
+      tics = DEMOTICS;                /* timedemos run as fast as they can */
+   else if (demoplayback || demorecord)   /* demo recording and playback needs to be constant */
    {
       /* wait up to DEMOTICS Wolf tics */
-      uint32_t curtime = LR_GetTicks();
+      uint32_t curtime = LR_GetGameTicks();
       lasttimecount += DEMOTICS;
       int32_t timediff = (lasttimecount * 100) / 7 - curtime;
       if(timediff > 0)
@@ -1150,6 +1152,10 @@ int32_t funnyticount;
 
 void PlayLoop (void)
 {
+   boolean  timedemo = demoplayback && param_timedemo != -1;
+   uint64_t framestart = 0;
+   uint64_t stagestart;
+
    playstate = EX_STILLPLAYING;
    lasttimecount = GetTimeCount();
    frameon = 0;
@@ -1165,23 +1171,39 @@ void PlayLoop (void)
    if (demoplayback)
       IN_StartAck ();
 
+   ProfStartFrames ();
+
    do
    {
+      if (timedemo)
+         framestart = LR_GetMicroTicks();
+
+      stagestart = ProfBegin(prof_controls);
       PollControls ();
+      ProfEnd(prof_controls, stagestart);
 
       /* actor thinking */
       madenoise = false;
 
+      stagestart = ProfBegin(prof_doors);
       MoveDoors ();
       MovePWalls ();
+      ProfEnd(prof_doors, stagestart);
 
+      stagestart = ProfBegin(prof_actors);
       for (obj = player; obj; obj = obj->next)
          DoActor (obj);
+      ProfEnd(prof_actors, stagestart);
 
+      stagestart = ProfBegin(prof_palette);
       UpdatePaletteShifts ();
+      ProfEnd(prof_palette, stagestart);
 
       ThreeDRefresh ();
 
+      if (timedemo)
+         TimeDemoFrame((uint32_t) (LR_GetMicroTicks() - framestart));
+
       /* MAKE FUNNY FACE IF BJ DOESN'T MOVE FOR AWHILE */
 #ifdef SPEAR
       funnyticount += tics;
@@ -1219,6 +1241,9 @@ void PlayLoop (void)
             playstate = EX_ABORT;
          }
       }
+
+      if (profiling)
+         ProfFrameDone ();
    }
    while (!playstate && !startgame);
 
@@ -0,0 +1,200 @@
+// WL_PROF.C
+
+#include <stdio.h>
+#include "wl_def.h"
+
+/*
+=============================================================================
+
+                              FRAME PROFILER
+
+The stages of a PlayLoop frame add their perf counter ticks to
+profstagetime[] through ProfBegin/ProfEnd, and ProfFrameDone folds the
+finished frame into the overlay averages and the CSV file.  The stages also
+show up in the trace file.  While none of them is wanted, profiling is false
+and every hook is a single test.
+
+The counter is the monotonic clock behind LR_GetTicks, which counts
+nanoseconds where clock_gettime is available.
+
+=============================================================================
+*/
+
+#define PROFAVERAGESHIFT 4           // the overlay averages about 16 frames
+
+boolean  profiling;
+uint64_t profstagetime[NUMPROFSTAGES];
+
+const char *profstagenames[NUMPROFSTAGES] =
+{
+   "controls", "doors", "actors", "palette", "walls", "sprites", "weapon", "screen"
+};
+
+static boolean  profoverlay;
+static FILE    *profcsv;
+static uint32_t profframe;
+static uint64_t profframestart;
+static uint64_t profaverage[NUMPROFSTAGES + 1];  // the last one is the whole frame
+
+static void ProfUpdate (void)
+{
+   profiling = profoverlay || profcsv || lr_tracing;
+   memset(profstagetime, 0, sizeof(profstagetime));
+   memset(profaverage, 0, sizeof(profaverage));
+   profframestart = 0;
+}
+
+/*
+===================
+=
+= ProfStartup
+=
+= Opens param_profilecsv and shows the overlay if param_profile asks for it
+=
+===================
+*/
+
+void ProfStartup (void)
+{
+   int i;
+
+   if (param_profilecsv[0])
+   {
+      profcsv = fopen(param_profilecsv, "w");
+      if (!profcsv)
+         Quit("Unable to create profile file %s", param_profilecsv);
+
+      fprintf(profcsv, "frame");
+      for (i = 0; i < NUMPROFSTAGES; i++)
+         fprintf(profcsv, ",%s", profstagenames[i]);
+      fprintf(profcsv, ",total\n");
+   }
+
+   profoverlay = param_profile;
+   ProfUpdate();
+}
+
+void ProfShutdown (void)
+{
+   if (profcsv)
+      fclose(profcsv);
+   profcsv     = NULL;
+   profoverlay = false;
+   ProfUpdate();
+}
+
+void ProfToggleOverlay (void)
+{
+   profoverlay ^= 1;
+   ProfUpdate();
+}
+
+boolean ProfOverlayShown (void)
+{
+   return profoverlay;
+}
+
+/*
+===================
+=
+= ProfStartFrames
+=
+= Called before the first frame of a PlayLoop, so the time spent outside of
+= it doesn't count as a frame
+=
+===================
+*/
+
+void ProfStartFrames (void)
+{
+   if (profiling)
+      profframestart = LR_GetPerfCounter();
+}
+
+/*
+===================
+=
+= ProfFrameDone
+=
+= The whole frame is the time since the last one finished, waiting included
+=
+===================
+*/
+
+void ProfFrameDone (void)
+{
+   uint64_t now   = LR_GetPerfCounter();
+   uint64_t total = profframestart ? now - profframestart : 0;
+   int i;
+
+   profframestart = now;
+
+   if (profcsv)
+   {
+      fprintf(profcsv, "%u", (unsigned) profframe);
+      for (i = 0; i < NUMPROFSTAGES; i++)
+         fprintf(profcsv, ",%.3f", profstagetime[i] / 1000.0);
+      fprintf(profcsv, ",%.3f\n", total / 1000.0);
+   }
+
+   for (i = 0; i < NUMPROFSTAGES; i++)
+   {
+      profaverage[i] += ((int64_t) profstagetime[i] - (int64_t) profaverage[i]) >> PROFAVERAGESHIFT;
+      profstagetime[i] = 0;
+   }
+   profaverage[NUMPROFSTAGES] += ((int64_t) total - (int64_t) profaverage[NUMPROFSTAGES]) >> PROFAVERAGESHIFT;
+
+   profframe++;
+}
+
+/*
+===================
+=
+= ProfDrawOverlay
+=
+= Prints the averaged stage times in microseconds into the top left corner
+= of the 3D view, as many lines as fit
+=
+===================
+*/
+
+void ProfDrawOverlay (void)
+{
+   int      oldpx = px, oldpy = py, oldfont = fontnumber;
+   byte     oldfontcolor = fontcolor, oldbackcolor = backcolor;
+   int      left, top, bottom, lineheight;
+   char     str[32];
+   int      i;
+
+   if (!profoverlay || viewwidth / scaleFactor < 80)
+      return;
+
+   fontnumber = 0;
+   lineheight = ((fontstruct *) grsegs[STARTFONT])->height;
+   left       = viewscreenx / scaleFactor + 2;
+   top        = viewscreeny / scaleFactor + 1;
+   bottom     = (viewscreeny + viewheight) / scaleFactor - 1;
+
+   for (i = 0; i <= NUMPROFSTAGES && top + (i + 1) * lineheight <= bottom; i++)
+   {
+      snprintf(str, sizeof(str), "%s %u", i < NUMPROFSTAGES ? profstagenames[i] : "frame",
+            (unsigned) (profaverage[i] / 1000));
+
+      /* a shadow keeps the numbers readable on any wall */
+      fontcolor = 0;
+      px = left + 1;
+      py = top + i * lineheight + 1;
+      VWB_DrawPropString(str);
+
+      fontcolor = 15;
+      px = left;
+      py = top + i * lineheight;
+      VWB_DrawPropString(str);
+   }
+
+   px = oldpx;
+   py = oldpy;
+   fontnumber   = oldfont;
+   fontcolor    = oldfontcolor;
+   backcolor    = oldbackcolor;
+}